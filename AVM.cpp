@@ -1,10 +1,18 @@
 #include "AVM.hpp"
 #include "Lexer.hpp"
 #include "Operand.hpp"
+#include "Probes.hpp"
+#include "Profile.hpp"
+#include "Snapshot.hpp"
+#include "Trace.hpp"
+#include <cstdlib>
+#include <chrono>
 
 bool    AVM::lexerError = false;
-bool	AVM::exitFlag = false;
+volatile sig_atomic_t   AVM::checkpointRequested = 0;
 std::vector<IOperand const*(*)(std::string const & value)>	AVM::operandFactory;
+std::map<std::string, void (AVM::*)(void)>                  AVM::funcWithoutArgs;
+std::map<std::string, void (AVM::*)(eOperandType, std::string const &)>    AVM::funcWithArgs;
 AVM		AVM::vm;
 
 void	checkTypes(const IOperand *& left, const IOperand *& right)
@@ -25,8 +33,10 @@ void	checkTypes(const IOperand *& left, const IOperand *& right)
 	}
 }
 
-AVM::AVM()
+AVM::AVM() : pc(0)
 {
+    if (!operandFactory.empty())
+        return ;
 
     using stringFuncArgPair = std::pair<std::string, void (AVM::*)(eOperandType, std::string const &)>;
 
@@ -44,6 +54,11 @@ AVM::AVM()
     funcWithoutArgs.insert(stringFuncPair("mod", &AVM::mod));
     funcWithoutArgs.insert(stringFuncPair("print", &AVM::print));
     funcWithoutArgs.insert(stringFuncPair("exit", &AVM::exit));
+    funcWithoutArgs.insert(stringFuncPair("dup", &AVM::dup));
+    funcWithoutArgs.insert(stringFuncPair("swap", &AVM::swap));
+    funcWithoutArgs.insert(stringFuncPair("over", &AVM::over));
+    funcWithoutArgs.insert(stringFuncPair("rot", &AVM::rot));
+    funcWithoutArgs.insert(stringFuncPair("clear", &AVM::clear));
 
     operandFactory.push_back(&AVM::createInt8);
     operandFactory.push_back(&AVM::createInt16);
@@ -56,10 +71,171 @@ AVM::AVM()
 
 void    AVM::runInstruction(instruction_t *instr)
 {
-	if (instr->arg)
-        (this->*funcWithArgs[*instr->name])(static_cast<eOperandType>(instr->arg->type), instr->arg->content);
+    if (instr->count != 1 && instr->opcode == OpPush)
+        pushMany(static_cast<eOperandType>(instr->arg->type), instr->arg->content, instr->count);
+    else if (instr->count != 1 && instr->opcode == OpPop)
+        popMany(instr->count);
+	else if (instr->arg)
+        (this->*funcWithArgs[instr->name])(static_cast<eOperandType>(instr->arg->type), instr->arg->content);
     else
-        (this->*funcWithoutArgs[*instr->name])();
+        (this->*funcWithoutArgs[instr->name])();
+}
+
+// Instructions run between two looks at the clock when a time limit is set.
+static const uint64_t   clockInterval = 4096;
+
+uint64_t    AVM::budgetSlice(uint64_t quantum, uint64_t done) const
+{
+    uint64_t    slice = limits.maxTime ? clockInterval : UINT64_MAX;
+
+    if (limits.maxInstructions)
+        slice = std::min(slice, limits.maxInstructions - executed);
+    if (quantum)
+        slice = std::min(slice, quantum - done);
+    return slice;
+}
+
+eRunStatus  AVM::exceeded(char const * limit)
+{
+    spill();
+    *err << "budget exceeded: " << limit << " limit reached !" << std::endl;
+    AVM::exit();
+    return BudgetExceeded;
+}
+
+eRunStatus  AVM::run(program_t const & program, uint64_t quantum)
+{
+    using clock = std::chrono::steady_clock;
+
+    eRunStatus          status = Finished;
+    clock::time_point   start = limits.maxTime ? clock::now() : clock::time_point();
+    uint64_t            done = 0;
+    uint64_t            slice = budgetSlice(quantum, done);
+    uint64_t            budget = slice;
+
+    auto                runTime = [&]() -> uint64_t
+    {
+        return elapsed + std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    };
+
+    for (; pc < program.size() && !exitFlag; )
+    {
+        instruction_t   *instr = program[pc].get();
+        size_t          next = pc + 1;
+
+        if (pc == breakpoint)
+        {
+            elapsed = limits.maxTime ? runTime() : 0;
+            status = Yielded;
+            break ;
+        }
+        if (!budget)
+        {
+            executed += slice;
+            done += slice;
+            if (limits.maxInstructions && executed >= limits.maxInstructions)
+                return exceeded("instruction");
+            if (limits.maxTime && runTime() >= limits.maxTime * 1000000)
+                return exceeded("time");
+            if (quantum && done >= quantum)
+            {
+                spill();
+                elapsed = limits.maxTime ? runTime() : 0;
+                return Yielded;
+            }
+            budget = slice = budgetSlice(quantum, done);
+        }
+        budget--;
+        if (limits.maxStack && instr->opcode == OpPush && vmStack.size() + cached + instr->count > limits.maxStack)
+            return exceeded("stack");
+
+        if (cached && !instr->handler)
+            spill();
+        AVM_PROBE4(dispatch, pc, static_cast<int>(instr->opcode), instr->line, instr->name);
+        if (tracer)
+            tracer->before(pc, instr, vmStack);
+        if (precomputed && (*precomputed)[pc])
+            runPrecomputed(instr);
+        else if (instr->handler)
+            (this->*instr->handler)(instr);
+        else if (instr->opcode >= OpRepeat && instr->opcode <= OpJnz)
+            next = branch(instr);
+        else
+            runInstruction(instr);
+        if (Profiler::sampleRequested && profiler)
+        {
+            Profiler::sampleRequested = 0;
+            profiler->sample(pc);
+        }
+        pc = next;
+        if (limits.maxStack && vmStack.size() + cached > limits.maxStack)
+            status = exceeded("stack");
+        if (exitFlag && instr->opcode != OpExit)
+            AVM_PROBE3(error, pc - 1, static_cast<int>(instr->opcode), instr->line);
+        if (tracer)
+        {
+            tracer->after(vmStack);
+            if (Tracer::dumpRequested || (exitFlag && instr->opcode != OpExit))
+            {
+                Tracer::dumpRequested = 0;
+                tracer->dump();
+            }
+        }
+
+        if (checkpointPath.empty() || exitFlag)
+            continue ;
+        if (checkpointRequested || (checkpointEvery && ++sinceCheckpoint == checkpointEvery))
+        {
+            checkpointRequested = 0;
+            sinceCheckpoint = 0;
+            spill();
+            Snapshot::save(checkpointPath, *this);
+        }
+    }
+    executed += slice - budget;
+    spill();
+    return status;
+}
+
+void    AVM::runPrecomputed(instruction_t *instr)
+{
+    if (instr->opcode != OpPush)
+    {
+        delete vmStack.back();
+        vmStack.pop_back();
+        delete vmStack.back();
+        vmStack.pop_back();
+    }
+    vmStack.push_back((*precomputed)[pc]);
+    (*precomputed)[pc] = 0;
+}
+
+size_t  AVM::branch(instruction_t const *instr)
+{
+    switch (instr->opcode)
+    {
+        case OpRepeat:
+            if (!instr->count)
+                return instr->target + 1;
+            loops.push_back(instr->count);
+            break ;
+        case OpEnd:
+            if (--loops.back())
+                return instr->target + 1;
+            loops.pop_back();
+            break ;
+        case OpJmp:
+            return instr->target;
+        default:
+            if (vmStack.empty())
+            {
+                *err << "runtime error: empty stack" << std::endl;
+                AVM::exit();
+            }
+            else if ((std::strtold(vmStack.back()->toString().c_str(), 0) == 0) == (instr->opcode == OpJz))
+                return instr->target;
+    }
+    return pc + 1;
 }
 
 IOperand const *AVM::createInt8(std::string const &value) {
@@ -92,7 +268,7 @@ IOperand const *AVM::createOperand(eOperandType type, std::string const &value)
 
 void AVM::exit() {
     exitFlag = true;
-    std::cout << "machine stopping " << std::endl;
+    *out << "machine stopping " << std::endl;
 }
 
 void AVM::push(eOperandType type, std::string const &value) {
@@ -105,26 +281,29 @@ void AVM::assertVM(eOperandType type, std::string const &value) {
 		auto *ptr = AVM::createOperand(type, value);
         if (vmStack.back()->getType() == type
             && *vmStack.back() == *ptr)
-            std::cout << "assert success" << std::endl;
+            *out << "assert success" << std::endl;
         else {
 			// std::cout << ptr->toString() << ' ' << vmStack.back()->toString() << std::endl;
-            std::cerr << "assert failed !" << std::endl;
+            *err << "assert failed !" << std::endl;
             AVM::exit();
         }
 		delete ptr;
     }
     else
-        std::cerr << "runtime error: stack is empty" << std::endl;
+        *err << "runtime error: stack is empty" << std::endl;
 }
 
 void AVM::pop() {
     if (vmStack.empty())
     {
-        std::cerr << "the stack is empty !" << std::endl;
+        *err << "the stack is empty !" << std::endl;
         AVM::exit();
     }
     else
+    {
+        delete vmStack.back();
         vmStack.pop_back();
+    }
 }
 
 std::ostream&operator<<(std::ostream & stream, IOperand const * operand)
@@ -135,13 +314,10 @@ std::ostream&operator<<(std::ostream & stream, IOperand const * operand)
 }
 
 void AVM::dump() {
-    auto it = vmStack.rbegin(), end = vmStack.rend();
-
     if (vmStack.empty())
-        std::cerr << "runtime error: empty stack" << std::endl;
+        *err << "runtime error: empty stack" << std::endl;
     else
-        while (it < end)
-            std::cout << *it++ << std::endl;
+        vmStack.forEachFromTop([this](IOperand const * operand) { *out << operand << std::endl; });
 }
 
 void AVM::print()
@@ -149,13 +325,13 @@ void AVM::print()
 	if (!vmStack.empty())
 	{
 		if (!vmStack.back()->getPrecision())
-			std::cout << static_cast<char>(std::atoi(vmStack.back()->toString().c_str())) << std::endl;
+			*out << static_cast<char>(std::atoi(vmStack.back()->toString().c_str())) << std::endl;
 		else
-			std::cerr << "print_assert failed !" << std::endl;
+			*err << "print_assert failed !" << std::endl;
 	}
 	else
 	{
-		std::cerr << "runtime error: empty stack" << std::endl;
+		*err << "runtime error: empty stack" << std::endl;
 		AVM::exit();
 	}
 }
@@ -174,7 +350,7 @@ void AVM::add() {
 		}
 		catch (std::exception const & ex)
 		{
-			std::cout << "runtime error instruction add: " << ex.what() << std::endl;
+			*out << "runtime error instruction add: " << ex.what() << std::endl;
 			AVM::exit();
 		}
 		delete right;
@@ -182,7 +358,7 @@ void AVM::add() {
 	}
 	else
 	{
-		std::cerr << "add failed, not enough arguments !" << std::endl;
+		*err << "add failed, not enough arguments !" << std::endl;
 		AVM::exit();
 	}
 }
@@ -201,7 +377,7 @@ void AVM::sub() {
 		}
 		catch (std::exception const & ex)
 		{
-			std::cout << "runtime error instruction sub: " << ex.what() << std::endl;
+			*out << "runtime error instruction sub: " << ex.what() << std::endl;
 			AVM::exit();
 		}
 		delete right;
@@ -209,7 +385,7 @@ void AVM::sub() {
 	}
 	else
 	{
-		std::cerr << "sub failed, not enough arguments !" << std::endl;
+		*err << "sub failed, not enough arguments !" << std::endl;
 		AVM::exit();
 	}
 }
@@ -228,7 +404,7 @@ void AVM::mul() {
 		}
 		catch (std::exception const & ex)
 		{
-			std::cout << "runtime error instruction mul: " << ex.what() << std::endl;
+			*out << "runtime error instruction mul: " << ex.what() << std::endl;
 			AVM::exit();
 		}
 		delete right;
@@ -236,7 +412,7 @@ void AVM::mul() {
 	}
 	else
 	{
-		std::cerr << "mul failed, not enough arguments !" << std::endl;
+		*err << "mul failed, not enough arguments !" << std::endl;
 		AVM::exit();
 	}
 }
@@ -255,7 +431,7 @@ void AVM::div() {
 		}
 		catch (std::exception const & ex)
 		{
-			std::cout << "runtime error instruction div: " << ex.what() << std::endl;
+			*out << "runtime error instruction div: " << ex.what() << std::endl;
 			AVM::exit();
 		}
 		delete right;
@@ -263,7 +439,7 @@ void AVM::div() {
 	}
 	else
 	{
-		std::cerr << "div failed, not enough arguments !" << std::endl;
+		*err << "div failed, not enough arguments !" << std::endl;
 		AVM::exit();
 	}
 }
@@ -282,7 +458,7 @@ void AVM::mod() {
 		}
 		catch (std::exception const & ex)
 		{
-			std::cout << "runtime error instruction mod: " << ex.what() << std::endl;
+			*out << "runtime error instruction mod: " << ex.what() << std::endl;
 			AVM::exit();
 		}
 		delete right;
@@ -290,7 +466,71 @@ void AVM::mod() {
 	}
 	else
 	{
-		std::cerr << "mod failed, not enough arguments !" << std::endl;
+		*err << "mod failed, not enough arguments !" << std::endl;
 		AVM::exit();
 	}
 }
+
+void AVM::pushMany(eOperandType type, std::string const &value, uint64_t count) {
+    if (!count)
+        return ;
+
+    IOperand const  *operand = AVM::createOperand(type, value);
+
+    vmStack.push_back(operand);
+    vmStack.pushCopies(operand, count - 1);
+}
+
+void AVM::popMany(uint64_t count) {
+    if (vmStack.size() < count)
+    {
+        *err << "pop failed, not enough arguments !" << std::endl;
+        AVM::exit();
+    }
+    else
+        vmStack.drop(count);
+}
+
+void AVM::dup() {
+    if (vmStack.empty())
+    {
+        *err << "dup failed, not enough arguments !" << std::endl;
+        AVM::exit();
+    }
+    else
+        vmStack.pushCopies(vmStack.back(), 1);
+}
+
+void AVM::swap() {
+    if (vmStack.size() < 2)
+    {
+        *err << "swap failed, not enough arguments !" << std::endl;
+        AVM::exit();
+    }
+    else
+        vmStack.rotate(2);
+}
+
+void AVM::over() {
+    if (vmStack.size() < 2)
+    {
+        *err << "over failed, not enough arguments !" << std::endl;
+        AVM::exit();
+    }
+    else
+        vmStack.pushCopies(vmStack.peek(1), 1);
+}
+
+void AVM::rot() {
+    if (vmStack.size() < 3)
+    {
+        *err << "rot failed, not enough arguments !" << std::endl;
+        AVM::exit();
+    }
+    else
+        vmStack.rotate(3);
+}
+
+void AVM::clear() {
+    vmStack.drop(vmStack.size());
+}
@@ -2,18 +2,67 @@
 # define AVM_HPP
 
 #include "IOperand.hpp"
+#include "Stack.hpp"
+#include "Ops.hpp"
 #include <stack>
 #include <map>
 #include <vector>
 #include <memory>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
 
 struct instruction_t;
+class Tracer;
+class Profiler;
+
+enum eOpcode
+{
+    OpPush,
+    OpAssert,
+    OpPop,
+    OpDump,
+    OpAdd,
+    OpSub,
+    OpMul,
+    OpDiv,
+    OpMod,
+    OpPrint,
+    OpExit,
+    OpRepeat,
+    OpEnd,
+    OpJmp,
+    OpJz,
+    OpJnz,
+    OpDup,
+    OpSwap,
+    OpOver,
+    OpRot,
+    OpClear
+};
+
+using program_t = std::vector<std::unique_ptr<instruction_t> >;
+
+enum eRunStatus
+{
+    Finished,
+    Yielded,
+    BudgetExceeded
+};
+
+// Per-run caps, 0 meaning unlimited. Instructions are counted per dispatch
+// (a counted push is one), time is wall time in milliseconds.
+struct  limits_t
+{
+    uint64_t    maxInstructions = 0;
+    uint64_t    maxTime = 0;
+    size_t      maxStack = 0;
+};
 
 class AVM
 {
 
-    AVM();
-    AVM(AVM const &) = default;
+    AVM(AVM const &) = delete;
     AVM & operator = (AVM const &) = delete;
 
     static IOperand const * createInt8     ( std::string const & value );
@@ -23,15 +72,25 @@ class AVM
     static IOperand const * createFloat    ( std::string const & value );
     static IOperand const * createDouble   ( std::string const & value );
 
-    std::vector<IOperand const *>      vmStack;
+    OperandStack                       vmStack;
+    size_t                             pc;
+    std::vector<uint64_t>              loops;
+    ops::slot_t                        tos[2];          // top of stack when cached, tos[cached - 1] on top
+    unsigned                           cached = 0;
 
     static std::vector<IOperand const*(*)(std::string const & value)>       operandFactory;
 
-    std::map<std::string, void (AVM::*)(void)>                              funcWithoutArgs;
-    std::map<std::string, void (AVM::*)(eOperandType, std::string const &)> funcWithArgs;
+    static std::map<std::string, void (AVM::*)(void)>                              funcWithoutArgs;
+    static std::map<std::string, void (AVM::*)(eOperandType, std::string const &)> funcWithArgs;
+
+    uint64_t                           executed = 0;
+    uint64_t                           elapsed = 0;     // ns spent in run() by earlier quanta
+    size_t                             sinceCheckpoint = 0;
 
 public:
 
+    AVM();
+
     static IOperand const* createOperand  ( eOperandType type, std::string const & value );
 
     void    push    ( eOperandType type, std::string const & value );
@@ -46,12 +105,59 @@ public:
     void    mod     ( void );
     void    print   ( void );
     void    exit    ( void );
+    void    dup     ( void );
+    void    swap    ( void );
+    void    over    ( void );
+    void    rot     ( void );
+    void    clear   ( void );
+
+    void    pushMany( eOperandType type, std::string const & value, uint64_t count );
+    void    popMany ( uint64_t count );
 
     void    runInstruction(instruction_t *);
+    void    runPrecomputed(instruction_t *);
+    size_t  branch(instruction_t const *);
+    uint64_t    budgetSlice(uint64_t quantum, uint64_t done) const;
+
+    template <typename Op, typename L, typename R>
+    void        arithmetic(instruction_t const *);
+    template <typename Op, typename L, typename R>
+    void        cachedArithmetic(instruction_t const *);
+    template <typename T>
+    void        take(T & value, long double & exact);
+    void        pushCached(instruction_t const *);
+    void        spill(void);
+    static IOperand const  *box(ops::slot_t const & slot);
+    eRunStatus  exceeded(char const * limit);
+    eRunStatus  run(program_t const & program, uint64_t quantum = 0);
+    void    setStackWindow(size_t window) { vmStack.setWindow(window); }
+    size_t  getPc(void) const { return pc; }
+
+    std::string     checkpointPath;
+    size_t          checkpointEvery = 0;
+    uint64_t        programHash = 0;
+    Tracer          *tracer = 0;
+    Profiler        *profiler = 0;
+    limits_t        limits;
+    size_t          breakpoint = SIZE_MAX;      // run() yields when pc reaches it
+
+    std::vector<IOperand const *>   *precomputed = 0;
+
+    std::ostream    *out = &std::cout;
+    std::ostream    *err = &std::cerr;
+    bool            exitFlag = false;
 
     static AVM  vm;
     static bool lexerError;
-    static bool exitFlag;
+
+    static volatile sig_atomic_t    checkpointRequested;
+
+    // [opcode - OpAdd][left type][right type]
+    static void (AVM::* const arithmeticHandlers[5][6][6])(instruction_t const *);
+    static void (AVM::* const cachedHandlers[5][6][6])(instruction_t const *);
+
+    friend struct Snapshot;
+    friend class Incremental;
 
 };
 
@@ -0,0 +1,158 @@
+#include "Aot.hpp"
+#include "Lexer.hpp"
+#include "Types.hpp"
+#include <algorithm>
+#include <sstream>
+
+static char const   *typeNames[] = { "int8_t", "int16_t", "int32_t", "int64_t", "float", "double" };
+static char const   *typeEnums[] = { "Int8", "Int16", "Int32", "Int64", "Float", "Double" };
+static char const   *opStructs[] = { "ops::addOp", "ops::subOp", "ops::mulOp", "ops::divOp", "ops::modOp" };
+
+Aot::Aot(program_t & program)
+    : program_(program), labels_(program.size() + 1), nesting_(program.size()),
+      left_(program.size(), -1), right_(program.size(), -1), depth_(0)
+{
+    TypeInference   types(program);
+    std::vector<int> crossing(program.size() + 2);
+    size_t          open = 0;
+
+    types.annotate();
+
+    for (size_t pc = 0; pc < program.size(); pc++)
+    {
+        instruction_t const     *instr = program[pc].get();
+
+        if (instr->opcode == OpEnd)
+            open--;
+        nesting_[pc] = open;
+        if (instr->opcode >= OpAdd && instr->opcode <= OpMod)
+        {
+            eOperandType    left, right;
+
+            if (types.operandTypes(pc, left, right))
+            {
+                left_[pc] = left;
+                right_[pc] = right;
+            }
+        }
+        size_t  label = SIZE_MAX;
+
+        if (instr->opcode == OpRepeat)
+        {
+            depth_ = std::max(depth_, ++open);
+            label = instr->target + 1;
+        }
+        else if (instr->opcode == OpEnd)
+            label = instr->target + 1;
+        else if (instr->opcode >= OpJmp && instr->opcode <= OpJnz)
+            label = instr->target;
+        if (label != SIZE_MAX)
+        {
+            labels_[label] = true;
+            crossing[std::min(pc, label) + 1]++;
+            crossing[std::max(pc, label) + 1]--;
+        }
+    }
+
+    // A function may start at pc when no jump goes between the
+    // instructions before and after it.
+    int     jumps = 0;
+
+    chunks_.push_back(0);
+    for (size_t pc = 1; pc < program.size(); pc++)
+    {
+        jumps += crossing[pc];
+        if (!jumps && pc - chunks_.back() >= chunkSize)
+            chunks_.push_back(pc);
+    }
+}
+
+std::string Aot::statement(size_t pc) const
+{
+    instruction_t const     *instr = program_[pc].get();
+    std::ostringstream      out;
+    std::string             loop = "loops[" + std::to_string(nesting_[pc]) + "]";
+
+    switch (instr->opcode)
+    {
+        case OpPush:
+            out << "vm.push(" << typeEnums[instr->arg->type] << ", \"" << instr->arg->content << "\"";
+            if (instr->count != 1)
+                out << ", " << instr->count << "ULL";
+            out << ");";
+            break ;
+        case OpPop:
+            if (instr->count != 1)
+                out << "if (!vm.pop(" << instr->count << "ULL)) return false;";
+            else
+                out << "if (!vm.pop()) return false;";
+            break ;
+        case OpAssert:
+            out << "if (!vm.assertTop(" << typeEnums[instr->arg->type] << ", \"" << instr->arg->content << "\")) return false;";
+            break ;
+        case OpAdd: case OpSub: case OpMul: case OpDiv: case OpMod:
+            out << "if (!vm.arithmetic<" << opStructs[instr->opcode - OpAdd];
+            if (left_[pc] >= 0)
+                out << ", " << typeNames[left_[pc]] << ", " << typeNames[right_[pc]];
+            out << ">()) return false;";
+            break ;
+        case OpDump:    out << "vm.dump();";                    break ;
+        case OpPrint:   out << "if (!vm.print()) return false;";    break ;
+        case OpExit:    out << "vm.exit();\n    return false;";     break ;
+        case OpDup:     out << "if (!vm.dup()) return false;";      break ;
+        case OpSwap:    out << "if (!vm.swap()) return false;";     break ;
+        case OpOver:    out << "if (!vm.over()) return false;";     break ;
+        case OpRot:     out << "if (!vm.rot()) return false;";      break ;
+        case OpClear:   out << "vm.clear();";                   break ;
+        case OpRepeat:
+            out << loop << " = " << instr->count << "ULL;\n    if (!" << loop << ") goto pc" << instr->target + 1 << ";";
+            break ;
+        case OpEnd:
+            out << "if (--" << loop << ") goto pc" << instr->target + 1 << ";";
+            break ;
+        case OpJmp:
+            out << "goto pc" << instr->target << ";";
+            break ;
+        case OpJz: case OpJnz:
+            out << "if (!vm.zero(zero)) return false;\n    if (" << (instr->opcode == OpJz ? "" : "!") << "zero) goto pc"
+                << instr->target << ";";
+            break ;
+    }
+    return out.str();
+}
+
+// IOperand.hpp, Arith.hpp, Ops.hpp and Runtime.hpp without their local
+// includes, generated by the Makefile
+static char const   runtime[] =
+#include "Runtime.inc"
+;
+
+void    Aot::write(std::ostream & out, std::string const & source) const
+{
+    out << "// " << source << ", compiled by avm --aot\n"
+        << "// build: c++ -std=c++11 -O2 this_file.cpp -o program\n\n"
+        << runtime;
+    for (size_t chunk = 0; chunk < chunks_.size(); chunk++)
+    {
+        size_t  end = chunk + 1 < chunks_.size() ? chunks_[chunk + 1] : program_.size();
+
+        out << "\nstatic bool    chunk" << chunk << "(aot::machine & vm)\n{\n"
+            << "    uint64_t        loops[" << std::max<size_t>(depth_, 1) << "];\n"
+            << "    bool            zero;\n\n"
+            << "    (void)loops;\n    (void)zero;\n";
+        for (size_t pc = chunks_[chunk]; pc <= end; pc++)
+        {
+            if (labels_[pc])
+                out << "pc" << pc << ":\n";
+            if (pc == end)
+                break ;
+            out << "    " << statement(pc) << "    // " << program_[pc]->line << ": " << program_[pc]->name << "\n";
+        }
+        out << "    return " << (end == program_.size() ? "false" : "true") << ";\n}\n";
+    }
+    out << "\nint     main(void)\n{\n"
+        << "    aot::machine    vm;\n\n";
+    for (size_t chunk = 0; chunk < chunks_.size(); chunk++)
+        out << "    if (!chunk" << chunk << "(vm))\n        return 0;\n";
+    out << "    return 0;\n}\n";
+}
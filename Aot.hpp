@@ -0,0 +1,43 @@
+#ifndef AOT_HPP
+# define AOT_HPP
+
+#include "AVM.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Ahead-of-time translation of a program into a C++ translation unit that
+// runs it on Runtime.hpp, which is copied into it: it builds on its own
+// with any C++11 compiler. Instructions become calls on the runtime in
+// program order, jumps become gotos, repeat counters are locals indexed by
+// nesting depth, and arithmetic whose operand types are inferred calls the
+// handler specialised for them. The program is cut into functions of about
+// chunkSize instructions wherever no jump crosses, so a long program does
+// not become one function the compiler takes minutes to optimise.
+
+class Aot
+{
+
+    program_t                   &program_;
+    std::vector<char>           labels_;
+    std::vector<size_t>         chunks_;    // first instruction of each function
+    std::vector<size_t>         nesting_;   // repeat blocks open around each instruction
+    std::vector<int8_t>         left_;      // inferred operand types, -1 when unknown
+    std::vector<int8_t>         right_;
+    size_t                      depth_;
+
+    static size_t const         chunkSize = 256;
+
+    std::string     statement   (size_t pc) const;
+
+public:
+
+    explicit Aot(program_t & program);
+    Aot(Aot const &) = delete;
+    Aot & operator = (Aot const &) = delete;
+
+    void    write   (std::ostream & out, std::string const & source) const;
+
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef ARITH_HPP
+# define ARITH_HPP
+
+#include "IOperand.hpp"
+#include <cstdint>
+
+// What the engines that keep operands unboxed share about their results:
+// the status of an operation, the operand type of a C++ type, and the
+// message the interpreter prints for an error. The operations themselves
+// are the ops:: statements of Ops.hpp. Integral operands are carried as the
+// int64 value of their text (a quotient may not fit its type, exactly like
+// the operand's string) and narrowed to T with two's complement wrapping,
+// as the interpreter's conversion does on the targets it runs on.
+
+namespace arith
+{
+
+enum eStatus
+{
+    Ok,
+    Overflow,
+    Underflow,
+    DivisionByZero
+};
+
+template <typename T> struct type_of;
+template <> struct type_of<int8_t>  { static const eOperandType value = Int8;   };
+template <> struct type_of<int16_t> { static const eOperandType value = Int16;  };
+template <> struct type_of<int32_t> { static const eOperandType value = Int32;  };
+template <> struct type_of<int64_t> { static const eOperandType value = Int64;  };
+template <> struct type_of<float>   { static const eOperandType value = Float;  };
+template <> struct type_of<double>  { static const eOperandType value = Double; };
+
+template <typename T>
+inline T            wrap(int64_t value)
+{
+    return static_cast<T>(static_cast<uint64_t>(value));
+}
+
+inline char const   *message(eStatus status)
+{
+    static const char* messages[] = { "", "overflow on argument!", "underflow on argument!", "division by zero !" };
+
+    return messages[status];
+}
+
+}
+
+#endif
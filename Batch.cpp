@@ -0,0 +1,504 @@
+#include "Batch.hpp"
+#include "Lexer.hpp"
+#include "Arith.hpp"
+#include "Ops.hpp"
+#include <sstream>
+
+static const char   binaryMagic[8] = { 'A', 'V', 'M', 'C', 'O', 'L', 'S', '1' };
+
+// The kernels run the interpreter's own ops:: statements on every row that
+// has not failed yet: integral columns carry the int64 value of each text,
+// floating ones the long double value of each text, and a floating result
+// is rounded through its text like the interpreter's.
+template <typename Op, typename T>
+static void         integralKernel(int64_t const * left, int64_t const * right, int64_t * result,
+                                   uint8_t * errors, uint32_t * errorPc, size_t rows, uint32_t pc)
+{
+    ops::slot_t     slot = { arith::type_of<T>::value, 0, 0, std::string() };
+
+    for (size_t i = 0; i < rows; i++)
+    {
+        ops::unboxed    out(slot);
+
+        if (errors[i])
+            continue ;
+        Op::template apply<T>(arith::wrap<T>(left[i]), right[i], out);
+        result[i] = static_cast<int64_t>(slot.exact);
+        if (out.status != arith::Ok)
+        {
+            errors[i] = out.status;
+            errorPc[i] = pc;
+        }
+    }
+}
+
+template <typename Op, typename T>
+static void         floatingKernel(long double const * left, long double const * right, long double * result,
+                                   uint8_t * errors, uint32_t * errorPc, size_t rows, uint32_t pc)
+{
+    ops::slot_t     slot = { arith::type_of<T>::value, 0, 0, std::string() };
+
+    for (size_t i = 0; i < rows; i++)
+    {
+        ops::unboxed    out(slot);
+
+        if (errors[i])
+            continue ;
+        Op::template apply<T>(static_cast<T>(left[i]), right[i], out);
+        result[i] = slot.exact;
+        if (out.status != arith::Ok)
+        {
+            errors[i] = out.status;
+            errorPc[i] = pc;
+        }
+    }
+}
+
+template <typename Op>
+static void         kernel(eOperandType type, std::vector<int64_t> const & leftInts, std::vector<int64_t> const & rightInts,
+                           std::vector<long double> const & leftReals, std::vector<long double> const & rightReals,
+                           std::vector<int64_t> & ints, std::vector<long double> & reals,
+                           std::vector<uint8_t> & errors, std::vector<uint32_t> & errorPc, uint32_t pc)
+{
+    size_t  rows = errors.size();
+
+    if (type <= Int64)
+        ints.resize(rows);
+    else
+        reals.resize(rows);
+    switch (type)
+    {
+        case Int8:      integralKernel<Op, int8_t>(leftInts.data(), rightInts.data(), ints.data(), errors.data(), errorPc.data(), rows, pc);     break;
+        case Int16:     integralKernel<Op, int16_t>(leftInts.data(), rightInts.data(), ints.data(), errors.data(), errorPc.data(), rows, pc);    break;
+        case Int32:     integralKernel<Op, int32_t>(leftInts.data(), rightInts.data(), ints.data(), errors.data(), errorPc.data(), rows, pc);    break;
+        case Int64:     integralKernel<Op, int64_t>(leftInts.data(), rightInts.data(), ints.data(), errors.data(), errorPc.data(), rows, pc);    break;
+        case Float:     floatingKernel<Op, float>(leftReals.data(), rightReals.data(), reals.data(), errors.data(), errorPc.data(), rows, pc);   break;
+        case Double:    floatingKernel<Op, double>(leftReals.data(), rightReals.data(), reals.data(), errors.data(), errorPc.data(), rows, pc);  break;
+    }
+}
+
+Batch::Batch(program_t const & program) : program_(program), rows_(0) {}
+
+void    Batch::load(std::string const & path)
+{
+    std::ifstream       file(path, std::ios::binary);
+    std::stringstream   content;
+
+    if (!file.is_open())
+        throw BadInputException();
+    content << file.rdbuf();
+
+    std::string         data = content.str();
+
+    if (data.compare(0, sizeof(binaryMagic), binaryMagic, sizeof(binaryMagic)) == 0)
+        loadBinary(data);
+    else
+        loadCsv(data);
+}
+
+static std::string  trim(std::string const & cell)
+{
+    size_t  begin = 0, end = cell.size();
+
+    while (begin < end && std::isspace(cell[begin])) begin++;
+    while (end > begin && std::isspace(cell[end - 1])) end--;
+    return cell.substr(begin, end - begin);
+}
+
+void    Batch::loadCsv(std::string const & data)
+{
+    std::vector<input_t *>      columns;
+    size_t                      lineEnd = data.find('\n');
+    size_t                      position = 0;
+
+    for (;;)
+    {
+        size_t          end = lineEnd == std::string::npos ? data.size() : lineEnd;
+        std::string     line = data.substr(position, end - position);
+
+        if (columns.empty() || !trim(line).empty())
+        {
+            size_t      column = 0, cellBegin = 0, cellEnd;
+
+            do
+            {
+                cellEnd = line.find(',', cellBegin);
+
+                std::string cell = trim(line.substr(cellBegin, cellEnd - cellBegin));
+
+                if (position == 0)
+                {
+                    inputs_["$" + cell].binary = false;
+                    columns.push_back(&inputs_["$" + cell]);
+                }
+                else if (column == columns.size())
+                    throw BadInputException();
+                else
+                    columns[column++]->texts.push_back(std::move(cell));
+                cellBegin = cellEnd + 1;
+            }
+            while (cellEnd != std::string::npos);
+            if (position != 0 && column != columns.size())
+                throw BadInputException();
+            rows_ += position != 0;
+        }
+        if (lineEnd == std::string::npos)
+            break ;
+        position = lineEnd + 1;
+        lineEnd = data.find('\n', position);
+    }
+}
+
+template <typename T>
+static T            readRaw(std::string const & data, size_t & offset)
+{
+    T   value;
+
+    if (data.size() - offset < sizeof(T))
+        throw Batch::BadInputException();
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+void    Batch::loadBinary(std::string const & data)
+{
+    size_t      offset = sizeof(binaryMagic);
+    uint32_t    columns = readRaw<uint32_t>(data, offset);
+    uint64_t    rows = readRaw<uint64_t>(data, offset);
+
+    if (rows > data.size())
+        throw BadInputException();
+    rows_ = rows;
+    while (columns--)
+    {
+        uint32_t    length = readRaw<uint32_t>(data, offset);
+
+        if (data.size() - offset < length)
+            throw BadInputException();
+
+        input_t     &input = inputs_["$" + data.substr(offset, length)];
+
+        offset += length;
+        input.binary = true;
+        input.integral = readRaw<uint8_t>(data, offset) == 0;
+        if (data.size() - offset < rows * 8)
+            throw BadInputException();
+        if (input.integral)
+            input.ints.resize(rows);
+        else
+            input.reals.resize(rows);
+        std::memcpy(input.integral ? static_cast<void *>(input.ints.data()) : static_cast<void *>(input.reals.data()),
+                    data.data() + offset, rows * 8);
+        offset += rows * 8;
+    }
+}
+
+void    Batch::rowError(size_t row, uint8_t error, uint32_t pc)
+{
+    if (!errors_[row])
+    {
+        errors_[row] = error;
+        errorPc_[row] = pc;
+    }
+}
+
+std::string Batch::text(column_t const & column, size_t row) const
+{
+    if (column.literal)
+        return *column.literal;
+    if (column.texts)
+        return (*column.texts)[row];
+    switch (column.type)
+    {
+        case Float:     return std::to_string(static_cast<float>(column.reals[row]));
+        case Double:    return std::to_string(static_cast<double>(column.reals[row]));
+        default:        return std::to_string(column.ints[row]);
+    }
+}
+
+void    Batch::pushLiteral(instruction_t const * instr)
+{
+    column_t    column;
+
+    column.type = static_cast<eOperandType>(instr->arg->type);
+    column.literal = &instr->arg->content;
+    column.texts = 0;
+    if (column.type <= Int64)
+        column.ints.assign(rows_, static_cast<int64_t>(std::strtold(column.literal->c_str(), 0)));
+    else
+        column.reals.assign(rows_, std::strtold(column.literal->c_str(), 0));
+    stack_.push_back(std::move(column));
+}
+
+void    Batch::pushParam(instruction_t const * instr, uint32_t pc)
+{
+    auto        input = inputs_.find(instr->arg->content);
+    column_t    column;
+
+    if (input == inputs_.end())
+        throw MissingParameterException();
+    column.type = static_cast<eOperandType>(instr->arg->type);
+    column.literal = 0;
+    column.texts = 0;
+    if (column.type <= Int64)
+        column.ints.resize(rows_);
+    else
+        column.reals.resize(rows_);
+
+    static const long double    limits[4][2] = { { INT8_MIN, INT8_MAX }, { INT16_MIN, INT16_MAX },
+                                                 { INT32_MIN, INT32_MAX }, { INT64_MIN, INT64_MAX } };
+
+    if (input->second.binary)
+    {
+        for (size_t row = 0; row < rows_; row++)
+        {
+            long double value = input->second.integral ? input->second.ints[row] : input->second.reals[row];
+
+            if (column.type <= Int64 && (value < limits[column.type][0] || value > limits[column.type][1]
+                                         || value != std::trunc(value)))
+                rowError(row, BadInput, pc);
+            else if (column.type <= Int64)
+                column.ints[row] = input->second.integral ? input->second.ints[row] : static_cast<int64_t>(value);
+            else if (column.type == Float)
+                column.reals[row] = static_cast<float>(value);
+            else
+                column.reals[row] = static_cast<double>(value);
+        }
+        stack_.push_back(std::move(column));
+        return ;
+    }
+
+    std::vector<std::string>    &texts = paramTexts_[instr->arg->content + static_cast<char>('0' + column.type)];
+
+    texts.resize(rows_);
+    for (size_t row = 0; row < rows_; row++)
+    {
+        try
+        {
+            texts[row] = Lexer::checkArgument(column.type, input->second.texts[row]);
+        }
+        catch (std::exception const &)
+        {
+            rowError(row, BadInput, pc);
+            continue ;
+        }
+        long double value = std::strtold(texts[row].c_str(), 0);
+
+        if (column.type <= Int64)
+            column.ints[row] = static_cast<int64_t>(value);
+        else
+            column.reals[row] = value;
+    }
+    column.texts = &texts;
+    stack_.push_back(std::move(column));
+}
+
+void    Batch::assertRows(instruction_t const * instr, uint32_t pc)
+{
+    column_t const      &top = stack_.back();
+    eOperandType        type = static_cast<eOperandType>(instr->arg->type);
+    std::string const   &expected = instr->arg->content;
+    std::stringstream   stream(expected);
+    int64_t             integral = 0;
+    float               single = 0;
+    double              real = 0;
+
+    if (type == Int16)          { int16_t tmp; stream >> tmp; integral = tmp; }
+    else if (type == Int32)     { int32_t tmp; stream >> tmp; integral = tmp; }
+    else if (type == Int64)     stream >> integral;
+    else if (type == Float)     stream >> single;
+    else if (type == Double)    stream >> real;
+
+    for (size_t row = 0; row < rows_; row++)
+    {
+        bool    success = top.type == type;
+
+        if (success && type == Int8)
+            success = text(top, row) == expected;
+        else if (success && type <= Int64)
+            success = top.ints[row] == integral;
+        else if (success && type == Float)
+            success = static_cast<float>(top.reals[row]) == single;
+        else if (success)
+            success = static_cast<double>(top.reals[row]) == real;
+        if (!success)
+            rowError(row, AssertFailed, pc);
+    }
+}
+
+std::vector<long double>    Batch::exact(column_t const & column) const
+{
+    if (column.type > Int64)
+        return column.reals;
+    return std::vector<long double>(column.ints.begin(), column.ints.end());
+}
+
+void    Batch::arithmetic(instruction_t const * instr, uint32_t pc)
+{
+    if (stack_.size() < 2)
+        throw StackErrorException(instr->line);
+
+    column_t    right = std::move(stack_.back());
+    stack_.pop_back();
+    column_t    left = std::move(stack_.back());
+    stack_.pop_back();
+
+    column_t    result;
+
+    result.type = std::max(left.type, right.type);
+    result.literal = 0;
+    result.texts = 0;
+
+    std::vector<int64_t>    leftInts, rightInts;
+    std::vector<long double>    leftReals, rightReals;
+
+    if (result.type <= Int64)
+    {
+        leftInts = std::move(left.ints);
+        rightInts = std::move(right.ints);
+    }
+    else
+    {
+        leftReals = left.type == result.type ? std::move(left.reals) : exact(left);
+        rightReals = right.type == result.type ? std::move(right.reals) : exact(right);
+    }
+
+    switch (instr->opcode)
+    {
+        case OpAdd: kernel<ops::addOp>(result.type, leftInts, rightInts, leftReals, rightReals, result.ints, result.reals, errors_, errorPc_, pc); break;
+        case OpSub: kernel<ops::subOp>(result.type, leftInts, rightInts, leftReals, rightReals, result.ints, result.reals, errors_, errorPc_, pc); break;
+        case OpMul: kernel<ops::mulOp>(result.type, leftInts, rightInts, leftReals, rightReals, result.ints, result.reals, errors_, errorPc_, pc); break;
+        case OpDiv: kernel<ops::divOp>(result.type, leftInts, rightInts, leftReals, rightReals, result.ints, result.reals, errors_, errorPc_, pc); break;
+        default:    kernel<ops::modOp>(result.type, leftInts, rightInts, leftReals, rightReals, result.ints, result.reals, errors_, errorPc_, pc); break;
+    }
+    stack_.push_back(std::move(result));
+}
+
+void    Batch::run()
+{
+    errors_.assign(rows_, 0);
+    errorPc_.assign(rows_, 0);
+    std::vector<uint64_t>   loops;
+
+    for (uint32_t pc = 0, next; pc < program_.size(); pc = next)
+    {
+        instruction_t const *instr = program_[pc].get();
+
+        next = pc + 1;
+        switch (instr->opcode)
+        {
+            case OpPush:
+                if (!instr->count)
+                    break ;
+                if (instr->arg->content[0] == '$')
+                    pushParam(instr, pc);
+                else
+                    pushLiteral(instr);
+                stack_.insert(stack_.end(), instr->count - 1, stack_.back());
+                break ;
+            case OpAssert:
+                if (stack_.empty())
+                    throw StackErrorException(instr->line);
+                assertRows(instr, pc);
+                break ;
+            case OpPop:
+                if (stack_.size() < instr->count)
+                    throw StackErrorException(instr->line);
+                stack_.resize(stack_.size() - instr->count);
+                break ;
+            case OpPrint:
+                if (stack_.empty())
+                    throw StackErrorException(instr->line);
+                break ;
+            case OpDup:
+            case OpOver:
+                if (stack_.size() < (instr->opcode == OpDup ? 1u : 2u))
+                    throw StackErrorException(instr->line);
+                stack_.push_back(stack_[stack_.size() - (instr->opcode == OpDup ? 1 : 2)]);
+                break ;
+            case OpSwap:
+            case OpRot:
+                if (stack_.size() < (instr->opcode == OpSwap ? 2u : 3u))
+                    throw StackErrorException(instr->line);
+                std::rotate(stack_.end() - (instr->opcode == OpSwap ? 2 : 3),
+                            stack_.end() - (instr->opcode == OpSwap ? 1 : 2), stack_.end());
+                break ;
+            case OpClear:
+                stack_.clear();
+                break ;
+            case OpDump:
+                break ;
+            case OpExit:
+                return ;
+            case OpRepeat:
+                if (!instr->count)
+                    next = instr->target + 1;
+                else
+                    loops.push_back(instr->count);
+                break ;
+            case OpEnd:
+                if (--loops.back())
+                    next = instr->target + 1;
+                else
+                    loops.pop_back();
+                break ;
+            case OpJmp:
+                next = instr->target;
+                break ;
+            case OpJz:
+            case OpJnz:
+                throw ConditionalJumpException();
+            default:
+                arithmetic(instr, pc);
+        }
+    }
+}
+
+void    Batch::write(std::ostream & out) const
+{
+    static const char   *instructions[] = { "add", "sub", "mul", "div", "mod" };
+    std::string         line = "row";
+
+    for (size_t slot = 0; slot < stack_.size(); slot++)
+        line += ",value" + std::to_string(slot);
+    out << line << ",error\n";
+    for (size_t row = 0; row < rows_; row++)
+    {
+        line = std::to_string(row);
+        if (!errors_[row])
+            for (auto it = stack_.rbegin(); it != stack_.rend(); it++)
+                line += ',' + text(*it, row);
+        else
+            line.append(stack_.size(), ',');
+        line += ',';
+
+        instruction_t const *instr = errors_[row] ? program_[errorPc_[row]].get() : 0;
+
+        if (errors_[row] == AssertFailed)
+            line += "line " + std::to_string(instr->line) + ": assert failed !";
+        else if (errors_[row] == BadInput)
+            line += "line " + std::to_string(instr->line) + ": bad value for " + instr->arg->content;
+        else if (errors_[row])
+            line += "line " + std::to_string(instr->line) + ": runtime error instruction "
+                    + instructions[instr->opcode - OpAdd] + ": " + arith::message(static_cast<arith::eStatus>(errors_[row]));
+        out << line << '\n';
+    }
+    out.flush();
+}
+
+const char *Batch::BadInputException::what() const throw() {
+    return "malformed batch input!";
+}
+
+const char *Batch::MissingParameterException::what() const throw() {
+    return "a named parameter is missing from the batch input!";
+}
+
+const char *Batch::StackErrorException::what() const throw() {
+    return "not enough operands on the stack!";
+}
+
+const char *Batch::ConditionalJumpException::what() const throw() {
+    return "conditional jumps are not supported in batch mode!";
+}
@@ -0,0 +1,111 @@
+#ifndef BATCH_HPP
+# define BATCH_HPP
+
+#include "AVM.hpp"
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Runs one program over every row of a columnar input at once. Stack slots
+// are whole columns (structure of arrays), so each instruction is a single
+// loop over the rows, running the interpreter's ops:: statements on each
+// row. A row that fails keeps its first error and the other rows go on;
+// dump and print have no per-row output in this mode. Repeat counts and jmp
+// are the same for every row; jz and jnz are refused.
+
+class Batch
+{
+
+    struct  column_t
+    {
+        eOperandType                    type;
+        std::vector<int64_t>            ints;
+        std::vector<long double>        reals;      // the value of each text
+        std::string const               *literal;
+        std::vector<std::string> const  *texts;
+    };
+
+    struct  input_t
+    {
+        std::vector<std::string>        texts;
+        std::vector<int64_t>            ints;
+        std::vector<double>             reals;
+        bool                            binary;
+        bool                            integral;
+    };
+
+    enum eRowError
+    {
+        AssertFailed = 4,
+        BadInput
+    };
+
+    program_t const                         &program_;
+    size_t                                  rows_;
+    std::map<std::string, input_t>          inputs_;
+    std::map<std::string, std::vector<std::string> > paramTexts_;
+    std::vector<column_t>                   stack_;
+    std::vector<uint8_t>                    errors_;
+    std::vector<uint32_t>                   errorPc_;
+
+    void            loadCsv     (std::string const & data);
+    void            loadBinary  (std::string const & data);
+
+    void            pushLiteral (instruction_t const * instr);
+    void            pushParam   (instruction_t const * instr, uint32_t pc);
+    void            assertRows  (instruction_t const * instr, uint32_t pc);
+    void            arithmetic  (instruction_t const * instr, uint32_t pc);
+
+    void            rowError    (size_t row, uint8_t error, uint32_t pc);
+    std::string     text        (column_t const & column, size_t row) const;
+
+    std::vector<long double>    exact(column_t const & column) const;
+
+public:
+
+    struct BadInputException : std::exception
+    {
+        BadInputException() = default;
+        ~BadInputException() throw() = default;
+        BadInputException&operator=(BadInputException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct MissingParameterException : std::exception
+    {
+        MissingParameterException() = default;
+        ~MissingParameterException() throw() = default;
+        MissingParameterException&operator=(MissingParameterException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct StackErrorException : std::exception
+    {
+        size_t  line;
+
+        explicit StackErrorException(size_t line) : line(line) {}
+        ~StackErrorException() throw() = default;
+        StackErrorException&operator=(StackErrorException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct ConditionalJumpException : std::exception
+    {
+        ConditionalJumpException() = default;
+        ~ConditionalJumpException() throw() = default;
+        ConditionalJumpException&operator=(ConditionalJumpException&) = delete;
+        const char * what() const throw();
+    };
+
+    explicit Batch(program_t const & program);
+    Batch(Batch const &) = delete;
+    Batch & operator = (Batch const &) = delete;
+
+    void    load    (std::string const & path);
+    void    run     (void);
+    void    write   (std::ostream & out) const;
+
+};
+
+#endif
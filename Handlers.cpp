@@ -0,0 +1,205 @@
+#include "AVM.hpp"
+#include "Operand.hpp"
+#include "Arith.hpp"
+#include "Ops.hpp"
+#include <cstdlib>
+
+// Monomorphic arithmetic: one handler per (operation, left type, right type),
+// picked once per instruction by type inference. The operations of Ops.hpp
+// repeat the statements of the matching Operand<T> operator on values that
+// are already unboxed, so results, texts and errors stay those of the generic
+// path. A promoted operand takes its value from its text, as checkTypes would.
+//
+// The cached handlers keep the top two stack slots unboxed in AVM::tos:
+// literal pushes and arithmetic work on them without allocating, and any
+// other instruction first spills them to the operand stack as operands.
+
+namespace
+{
+
+// The value the factory would parse back from the text of a result.
+template <typename T>
+IOperand const  *result(T value, std::string const & text)
+{
+    if (std::is_floating_point<T>::value)
+        value = static_cast<T>(std::strtold(text.c_str(), 0));
+    return new Operand<T>(value, text, arith::type_of<T>::value);
+}
+
+// Where an operation leaves a boxed result: a new operand.
+struct  boxed
+{
+    IOperand const  *operand = 0;
+    arith::eStatus  status = arith::Ok;
+
+    void    fail(arith::eStatus error) { status = error; }
+
+    template <typename T>
+    void    value(T tmp) { operand = result<T>(tmp, std::to_string(tmp)); }
+
+    template <typename T>
+    void    quotient(int64_t tmp) { operand = result<T>(static_cast<T>(static_cast<long double>(tmp)), std::to_string(tmp)); }
+};
+
+template <typename T>
+long double     textValue(Operand<T> const & operand, typename std::enable_if<std::is_integral<T>::value>::type * = 0)
+{
+    long double value = operand.getValue();
+
+    // only a quotient like int8(-128) / int8(-1) leaves a text its type cannot hold
+    if (operand.getValue() == std::numeric_limits<T>::min() && operand.toString()[0] != '-')
+        value = -value;
+    return value;
+}
+
+template <typename T>
+long double     textValue(Operand<T> const & operand, typename std::enable_if<std::is_floating_point<T>::value>::type * = 0)
+{
+    return std::strtold(operand.toString().c_str(), 0);
+}
+
+}
+
+template <typename Op, typename L, typename R>
+void    AVM::arithmetic(instruction_t const *)
+{
+    using T = typename std::conditional<(arith::type_of<L>::value >= arith::type_of<R>::value), L, R>::type;
+
+    if (vmStack.size() < 2)
+    {
+        *err << Op::name() << " failed, not enough arguments !" << std::endl;
+        AVM::exit();
+        return ;
+    }
+
+    Operand<R> const    *right = static_cast<Operand<R> const *>(vmStack.back());
+    vmStack.pop_back();
+    Operand<L> const    *left = static_cast<Operand<L> const *>(vmStack.back());
+    vmStack.pop_back();
+
+    T                   argValue = std::is_same<L, T>::value ? static_cast<T>(left->getValue())
+                                                             : static_cast<T>(textValue(*left));
+    bool const          unboxed = std::is_same<R, T>::value && std::is_floating_point<T>::value && !Op::exactRight;
+    long double         rightArgument = unboxed ? right->getValue() : textValue(*right);
+
+    boxed               sink;
+
+    Op::template apply<T>(argValue, rightArgument, sink);
+    if (sink.status == arith::Ok)
+        vmStack.push_back(sink.operand);
+    else
+    {
+        *out << "runtime error instruction " << Op::name() << ": " << arith::message(sink.status) << std::endl;
+        AVM::exit();
+    }
+    delete right;
+    delete left;
+}
+
+// Pops the top operand as its value and the value of its text.
+template <typename T>
+void    AVM::take(T & value, long double & exact)
+{
+    if (cached)
+    {
+        exact = tos[--cached].exact;
+        value = static_cast<T>(exact);
+        return ;
+    }
+
+    Operand<T> const    *operand = static_cast<Operand<T> const *>(vmStack.back());
+
+    value = operand->getValue();
+    exact = textValue(*operand);
+    vmStack.pop_back();
+    delete operand;
+}
+
+template <typename Op, typename L, typename R>
+void    AVM::cachedArithmetic(instruction_t const *)
+{
+    using T = typename std::conditional<(arith::type_of<L>::value >= arith::type_of<R>::value), L, R>::type;
+
+    if (vmStack.size() + cached < 2)
+    {
+        *err << Op::name() << " failed, not enough arguments !" << std::endl;
+        AVM::exit();
+        return ;
+    }
+
+    R                   rightValue;
+    L                   leftValue;
+    long double         rightExact, leftExact;
+
+    take(rightValue, rightExact);
+    take(leftValue, leftExact);
+
+    T                   argValue = std::is_same<L, T>::value ? static_cast<T>(leftValue) : static_cast<T>(leftExact);
+    bool const          unboxedRight = std::is_same<R, T>::value && std::is_floating_point<T>::value && !Op::exactRight;
+    long double         rightArgument = unboxedRight ? rightValue : rightExact;
+
+    ops::unboxed        sink(tos[0]);
+
+    Op::template apply<T>(argValue, rightArgument, sink);
+    if (sink.status == arith::Ok)
+        cached = 1;
+    else
+    {
+        *out << "runtime error instruction " << Op::name() << ": " << arith::message(sink.status) << std::endl;
+        AVM::exit();
+    }
+}
+
+void    AVM::pushCached(instruction_t const * instr)
+{
+    if (cached == 2)
+    {
+        vmStack.push_back(box(tos[0]));
+        std::swap(tos[0], tos[1]);
+        cached = 1;
+    }
+
+    ops::slot_t &slot = tos[cached++];
+
+    slot.type = static_cast<eOperandType>(instr->arg->type);
+    slot.literal = instr->arg->content.c_str();
+    slot.exact = std::strtold(slot.literal, 0);
+}
+
+void    AVM::spill()
+{
+    for (unsigned i = 0; i < cached; i++)
+        vmStack.push_back(box(tos[i]));
+    cached = 0;
+}
+
+template <typename T>
+static IOperand const   *boxSlot(ops::slot_t const & slot)
+{
+    return new Operand<T>(static_cast<T>(slot.exact), ops::text(slot), slot.type);
+}
+
+IOperand const  *AVM::box(ops::slot_t const & slot)
+{
+    switch (slot.type)
+    {
+        case Int8:      return boxSlot<int8_t>(slot);
+        case Int16:     return boxSlot<int16_t>(slot);
+        case Int32:     return boxSlot<int32_t>(slot);
+        case Int64:     return boxSlot<int64_t>(slot);
+        case Float:     return boxSlot<float>(slot);
+        case Double:    return boxSlot<double>(slot);
+    }
+    return 0;
+}
+
+#define HANDLER_ROW(H, Op, L)   { &AVM::H<Op, L, int8_t>, &AVM::H<Op, L, int16_t>, \
+                                  &AVM::H<Op, L, int32_t>, &AVM::H<Op, L, int64_t>, \
+                                  &AVM::H<Op, L, float>, &AVM::H<Op, L, double> }
+#define HANDLER_OP(H, Op)       { HANDLER_ROW(H, Op, int8_t), HANDLER_ROW(H, Op, int16_t), HANDLER_ROW(H, Op, int32_t), \
+                                  HANDLER_ROW(H, Op, int64_t), HANDLER_ROW(H, Op, float), HANDLER_ROW(H, Op, double) }
+#define HANDLER_TABLE(H)        { HANDLER_OP(H, ops::addOp), HANDLER_OP(H, ops::subOp), HANDLER_OP(H, ops::mulOp), \
+                                  HANDLER_OP(H, ops::divOp), HANDLER_OP(H, ops::modOp) }
+
+void    (AVM::* const AVM::arithmeticHandlers[5][6][6])(instruction_t const *) = HANDLER_TABLE(arithmetic);
+void    (AVM::* const AVM::cachedHandlers[5][6][6])(instruction_t const *) = HANDLER_TABLE(cachedArithmetic);
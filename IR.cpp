@@ -0,0 +1,394 @@
+#include "IR.hpp"
+#include "Lexer.hpp"
+#include <algorithm>
+
+static const char* types[] = {"int8", "int16", "int32", "int64", "float", "double"};
+
+IR::IR(program_t const & program) : program_(program)
+{
+    build();
+}
+
+IR::~IR()
+{
+    for (node_t & node : nodes_)
+        delete node.constant;
+}
+
+void    IR::build()
+{
+    std::vector<int>    stack;
+
+    for (size_t pc = 0; pc < program_.size(); pc++)
+    {
+        instruction_t const *instr = program_[pc].get();
+        step_t              step = { pc, -1 };
+        node_t              node = { instr->opcode, Int8, Int8, -1, -1, pc, -1, 0, -1, false, false, false };
+
+        switch (instr->opcode)
+        {
+            case OpPush:
+                node.type = static_cast<eOperandType>(instr->arg->type);
+                if (instr->arg->content[0] != '$')
+                    node.constant = AVM::createOperand(node.type, instr->arg->content);
+                step.node = static_cast<int>(nodes_.size());
+                stack.push_back(step.node);
+                nodes_.push_back(node);
+                break ;
+            case OpPop:
+                if (stack.size() < instr->count)
+                {
+                    steps_.push_back(step);
+                    return ;
+                }
+                if (!instr->count)
+                    continue ;
+                // With enough slots, pop N is N pops
+                for (uint64_t i = 1; i < instr->count; i++)
+                {
+                    steps_.push_back(step_t{ pc, stack.back() });
+                    stack.pop_back();
+                }
+                step.node = stack.back();
+                stack.pop_back();
+                break ;
+            case OpDump:
+                for (int id : stack)
+                    nodes_[id].observed = true;
+                break ;
+            case OpAssert:
+            case OpPrint:
+                if (!stack.empty())
+                    nodes_[stack.back()].observed = true;
+                else if (instr->opcode == OpPrint)
+                {
+                    steps_.push_back(step);
+                    return ;
+                }
+                break ;
+            case OpExit:
+                // --batch writes the stack left at exit
+                for (int id : stack)
+                    nodes_[id].observed = true;
+                steps_.push_back(step);
+                return ;
+            case OpDup:
+            case OpOver:
+            case OpSwap:
+            case OpRot:
+            {
+                size_t  moved = instr->opcode == OpDup ? 1 : instr->opcode == OpRot ? 3 : 2;
+
+                if (stack.size() < moved)
+                {
+                    steps_.push_back(step);
+                    return ;
+                }
+                // The slots a stack op moves or copies have to be there, as
+                // they are, in the lowered program too
+                for (size_t depth = 0; depth < moved; depth++)
+                    nodes_[stack[stack.size() - 1 - depth]].observed = true;
+                if (instr->opcode == OpSwap || instr->opcode == OpRot)
+                {
+                    std::rotate(stack.end() - moved, stack.end() - moved + 1, stack.end());
+                    break ;
+                }
+                node.left = stack[stack.size() - moved];
+                node.type = nodes_[node.left].type;
+                if (nodes_[node.left].constant)
+                    node.constant = AVM::createOperand(node.type, nodes_[node.left].constant->toString());
+                step.node = static_cast<int>(nodes_.size());
+                stack.push_back(step.node);
+                nodes_.push_back(node);
+                break ;
+            }
+            case OpClear:
+                stack.clear();
+                break ;
+            default:
+                if (stack.size() < 2)
+                {
+                    steps_.push_back(step);
+                    return ;
+                }
+                node.right = stack.back();
+                stack.pop_back();
+                node.left = stack.back();
+                stack.pop_back();
+                step.node = static_cast<int>(nodes_.size());
+                nodes_[node.left].user = step.node;
+                nodes_[node.right].user = step.node;
+                node.type = std::max(nodes_[node.left].type, nodes_[node.right].type);
+                fold(node);
+                stack.push_back(step.node);
+                nodes_.push_back(node);
+        }
+        steps_.push_back(step);
+    }
+}
+
+void    IR::fold(node_t & node)
+{
+    IOperand const  *left = nodes_[node.left].constant;
+    IOperand const  *right = nodes_[node.right].constant;
+
+    if (!left || !right)
+        return ;
+    left = AVM::createOperand(node.type, left->toString());
+    right = AVM::createOperand(node.type, right->toString());
+    try
+    {
+        switch (node.opcode)
+        {
+            case OpAdd: node.constant = *left + *right; break;
+            case OpSub: node.constant = *left - *right; break;
+            case OpMul: node.constant = *left * *right; break;
+            case OpDiv: node.constant = *left / *right; break;
+            default:    node.constant = *left % *right; break;
+        }
+    }
+    catch (std::exception const &)
+    {
+        node.fails = true;
+    }
+    delete left;
+    delete right;
+}
+
+std::string IR::key(node_t const & node) const
+{
+    if (node.opcode == OpDup || node.opcode == OpOver)
+        return key(nodes_[node.left]);
+    if (node.constant)
+        return std::string(1, 'c') + types[node.type] + ':' + node.constant->toString();
+    if (node.opcode == OpPush)
+        return std::string(1, 'p') + types[node.type] + ':' + program_[node.pc]->arg->content;
+    return std::string(1, 'o') + std::to_string(node.opcode) + ':' + std::to_string(nodes_[node.left].number)
+           + ':' + std::to_string(nodes_[node.right].number);
+}
+
+void    IR::optimize()
+{
+    std::map<std::string, int>  numbers;
+
+    for (node_t & node : nodes_)
+        node.number = numbers.insert(std::make_pair(key(node), static_cast<int>(numbers.size()))).first->second;
+
+    for (size_t id = nodes_.size(); id-- > 0; )
+    {
+        node_t  &node = nodes_[id];
+
+        node.live = node.live || node.observed || (node.opcode != OpPush && !node.constant);
+        if (node.live && node.opcode != OpPush && !node.constant)
+        {
+            nodes_[node.left].live = true;
+            if (node.right >= 0)
+                nodes_[node.right].live = true;
+        }
+    }
+
+    for (node_t & node : nodes_)
+    {
+        node.emitType = node.type;
+        if (node.live && node.constant && !node.observed && node.user >= 0 && node.opcode != OpDup
+            && node.opcode != OpOver && !nodes_[node.user].constant && nodes_[node.user].type > node.type)
+            node.emitType = nodes_[node.user].type;
+    }
+}
+
+static instruction_t    *makePush(size_t line, int type, std::string content)
+{
+    return new instruction_t(Lexer::instrName(OpPush), OpPush, line, new arg_t(type, content));
+}
+
+static instruction_t    *copyInstruction(instruction_t const * source)
+{
+    std::string content;
+
+    if (source->arg)
+        content = source->arg->content;
+    instruction_t   *copy = new instruction_t(Lexer::instrName(source->opcode), source->opcode, source->line,
+                                              source->arg ? new arg_t(source->arg->type, content) : 0);
+
+    copy->count = source->count;
+    return copy;
+}
+
+static instruction_t    *makeOp(size_t line, eOpcode opcode)
+{
+    return new instruction_t(Lexer::instrName(opcode), opcode, line);
+}
+
+// The lowered stack is the program's stack without the dropped values. A
+// value whose instructions form a range that only computes it, and whose
+// number matches the top or the next slot of the lowered stack, is copied
+// from there with dup or over instead of being computed again.
+size_t  IR::lower(program_t & lowered) const
+{
+    std::vector<size_t> first(nodes_.size());   // first pc of the range computing each value
+    std::vector<size_t> size(nodes_.size());    // values computed in that range
+    std::vector<int>    present;
+    size_t              reused = 0;
+
+    for (size_t id = 0; id < nodes_.size(); id++)
+    {
+        node_t const    &node = nodes_[id];
+        bool            computed = node.opcode >= OpAdd && node.opcode <= OpMod;
+
+        first[id] = computed ? std::min(first[node.left], first[node.right]) : node.pc;
+        size[id] = computed ? size[node.left] + size[node.right] + 1 : 1;
+    }
+
+    for (size_t index = 0; index < steps_.size(); index++)
+    {
+        step_t const        &step = steps_[index];
+        instruction_t const *instr = program_[step.pc].get();
+        node_t const        *node = step.node >= 0 ? &nodes_[step.node] : 0;
+
+        if (instr->opcode == OpPush && !present.empty())
+        {
+            // The first instruction of a range whose value is already there
+            int     root = step.node;
+            bool    copied = false;
+
+            while (nodes_[root].user >= 0 && first[nodes_[root].user] == step.pc
+                   && nodes_[nodes_[root].user].pc - step.pc + 1 == size[nodes_[root].user])
+                root = nodes_[root].user;
+            while (root >= 0 && first[root] == step.pc)
+            {
+                node_t const    &value = nodes_[root];
+                size_t          depth = 0;
+
+                for (; depth < 2 && depth < present.size(); depth++)
+                {
+                    node_t const    &there = nodes_[present[present.size() - 1 - depth]];
+
+                    if (there.number == value.number && there.emitType == value.emitType)
+                        break ;
+                }
+                if (value.live && value.pc - step.pc + 1 == size[root] && depth < 2 && depth < present.size())
+                {
+                    lowered.emplace_back(makeOp(instr->line, depth ? OpOver : OpDup));
+                    present.push_back(root);
+                    index = std::lower_bound(steps_.begin() + index, steps_.end(), value.pc,
+                                             [](step_t const & a, size_t pc) { return a.pc < pc; }) - steps_.begin();
+                    reused++;
+                    copied = true;
+                    break ;
+                }
+                if (value.opcode < OpAdd || value.opcode > OpMod)
+                    break ;
+                root = first[value.left] == step.pc ? value.left : value.right;
+            }
+            if (copied)
+                continue ;
+        }
+
+        if (instr->opcode == OpPush && node->live)
+        {
+            lowered.emplace_back(makePush(instr->line, node->emitType,
+                                          node->constant ? node->constant->toString() : instr->arg->content));
+            present.push_back(step.node);
+        }
+        else if (instr->opcode == OpPush)
+            continue ;
+        else if (instr->opcode == OpPop && node && !node->live)
+            continue ;
+        else if (instr->opcode == OpPop && node)
+        {
+            lowered.emplace_back(makeOp(instr->line, OpPop));
+            present.pop_back();
+        }
+        else if (instr->opcode == OpDup || instr->opcode == OpOver)
+        {
+            if (!node || node->live)
+                lowered.emplace_back(copyInstruction(instr));
+            if (node && node->live)
+                present.push_back(step.node);
+        }
+        else if (node && instr->opcode != OpPop && node->constant)
+        {
+            for (int input : { node->right, node->left })
+                if (nodes_[input].live)
+                {
+                    lowered.emplace_back(makeOp(instr->line, OpPop));
+                    present.pop_back();
+                }
+            if (node->live)
+            {
+                lowered.emplace_back(makePush(instr->line, node->emitType, node->constant->toString()));
+                present.push_back(step.node);
+            }
+        }
+        else
+        {
+            lowered.emplace_back(copyInstruction(instr));
+            if (instr->opcode == OpPop && !present.empty())
+                present.pop_back();
+            else if (instr->opcode == OpSwap || instr->opcode == OpRot)
+            {
+                size_t  moved = instr->opcode == OpSwap ? 2 : 3;
+
+                if (present.size() >= moved)
+                    std::rotate(present.end() - moved, present.end() - moved + 1, present.end());
+            }
+            else if (instr->opcode == OpClear)
+                present.clear();
+            else if (node && present.size() >= 2)
+            {
+                present.resize(present.size() - 2);
+                present.push_back(step.node);
+            }
+        }
+    }
+    if (lowered.empty() || lowered.back()->opcode != OpExit)
+        lowered.emplace_back(makeOp(program_.back()->line, OpExit));
+    return reused;
+}
+
+void    IR::dump(std::ostream & out) const
+{
+    size_t              live = 0, folded = 0;
+    program_t           lowered;
+    size_t              reused = lower(lowered);
+
+    for (node_t const & node : nodes_)
+    {
+        live += node.live;
+        folded += node.opcode >= OpAdd && node.opcode <= OpMod && node.constant;
+    }
+    out << "; " << program_.size() << " instructions, " << nodes_.size() << " values: " << live << " live, "
+        << folded << " folded, " << nodes_.size() - live << " dropped, " << reused << " reused" << std::endl;
+
+    for (size_t id = 0; id < nodes_.size(); id++)
+    {
+        node_t const    &node = nodes_[id];
+
+        out << 'v' << id << "\t= " << Lexer::instrName(node.opcode);
+        if (node.opcode == OpPush)
+            out << ' ' << program_[node.pc]->arg->content;
+        else if (node.right < 0)
+            out << " v" << node.left;
+        else
+            out << " v" << node.left << " v" << node.right;
+        out << "\t: " << types[node.type] << "\t#" << node.number;
+        if (node.opcode != OpPush && node.constant)
+            out << "\t= " << node.constant->toString();
+        out << "\tline " << program_[node.pc]->line << '\t'
+            << (node.fails ? "fails" : node.live ? "live" : "dropped");
+        if (node.emitType != node.type)
+            out << " as " << types[node.emitType];
+        out << std::endl;
+    }
+
+    out << "; lowered to " << lowered.size() << " instructions" << std::endl;
+    for (std::unique_ptr<instruction_t> const & instr : lowered)
+    {
+        out << instr->name;
+        if (instr->arg)
+            out << ' ' << types[instr->arg->type] << '(' << instr->arg->content << ')';
+        if (instr->count != 1)
+            out << ' ' << instr->count;
+        out << std::endl;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef IR_HPP
+# define IR_HPP
+
+#include "AVM.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+#include <map>
+
+// Dataflow form of a program: every stack slot the program creates is a
+// value with its typed inputs, and dump/print/assert are the observers.
+// dup and over make a copy value of their source; the slots a stack op
+// moves or copies count as observed, so they keep their place and type.
+// Values computed from literals are folded with the interpreter's own
+// operands, equal values share a value number, values that are neither
+// observed nor able to fail are dropped, and literals only used by a wider
+// operation are pushed with the wider type. lower() rebuilds a program that
+// prints the same output, copying a value with dup or over when an equal
+// one is on top of the stack, and returns how many it copied.
+
+class IR
+{
+
+    struct  node_t
+    {
+        eOpcode             opcode;
+        eOperandType        type;
+        eOperandType        emitType;
+        int                 left;
+        int                 right;
+        size_t              pc;
+        int                 number;
+        IOperand const      *constant;
+        int                 user;
+        bool                observed;
+        bool                live;
+        bool                fails;
+    };
+
+    struct  step_t
+    {
+        size_t              pc;
+        int                 node;
+    };
+
+    program_t const         &program_;
+    std::vector<node_t>     nodes_;
+    std::vector<step_t>     steps_;
+
+    void                    build   (void);
+    void                    fold    (node_t & node);
+    std::string             key     (node_t const & node) const;
+
+public:
+
+    explicit IR(program_t const & program);
+    IR(IR const &) = delete;
+    IR & operator = (IR const &) = delete;
+    ~IR();
+
+    void    optimize    (void);
+    size_t  lower       (program_t & lowered) const;
+    void    dump        (std::ostream & out) const;
+
+};
+
+#endif
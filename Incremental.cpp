@@ -0,0 +1,287 @@
+#include "Incremental.hpp"
+#include "Lexer.hpp"
+#include "Snapshot.hpp"
+#include "Transcript.hpp"
+#include "Types.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sys/stat.h>
+#include <utime.h>
+
+static const char   checkpointMagic[8] = { 'A', 'V', 'M', 'P', 'R', 'E', 'F', '2' };
+static const char   checkpointSuffix[] = ".avmc";
+
+static void         appendString(std::string & buffer, std::string const & text)
+{
+    uint64_t    size = text.size();
+
+    buffer.append(reinterpret_cast<char const *>(&size), sizeof(size));
+    buffer += text;
+}
+
+static bool         readString(char const *& it, char const * end, std::string & text)
+{
+    uint64_t    size;
+
+    if (static_cast<size_t>(end - it) < sizeof(size))
+        return false;
+    std::memcpy(&size, it, sizeof(size));
+    it += sizeof(size);
+    if (static_cast<uint64_t>(end - it) < size)
+        return false;
+    text.assign(it, size);
+    it += size;
+    return true;
+}
+
+Incremental::Incremental(size_t interval, std::string const & cacheDir, uint64_t maxBytes)
+    : interval_(interval ? interval : 1), cacheDir_(cacheDir), maxBytes_(maxBytes), resumedAt_(0)
+{
+    if (!cacheDir_.empty())
+        mkdir(cacheDir_.c_str(), 0777);
+}
+
+void        Incremental::boundaries(std::string const & source, program_t const & program,
+                                    std::vector<boundary_t> & marks) const
+{
+    uint64_t    hash = 14695981039346656037ULL;
+    size_t      line = 0;
+    size_t      pc = 0;
+    size_t      reach = 0;
+
+    for (char c : source)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        if (c != '\n' || ++line % interval_)
+            continue ;
+        for (; pc < program.size() && program[pc]->line <= line; pc++)
+        {
+            instruction_t const     *instr = program[pc].get();
+
+            // Where the prefix may leave for: a jump, or a repeat run zero times
+            if ((instr->opcode >= OpJmp && instr->opcode <= OpJnz) || (instr->opcode == OpRepeat && !instr->count))
+                reach = std::max(reach, instr->target + 1);
+        }
+        if (pc < program.size() && reach <= pc && (marks.empty() || marks.back().pc < pc))
+            marks.push_back(boundary_t{ pc, line, hash });
+    }
+}
+
+std::string Incremental::cachePath(uint64_t hash) const
+{
+    char    name[32];
+
+    std::snprintf(name, sizeof(name), "/%016llx", static_cast<unsigned long long>(hash));
+    return cacheDir_ + name + checkpointSuffix;
+}
+
+Incremental::checkpoint_t const *Incremental::find(uint64_t hash)
+{
+    auto        found = checkpoints_.find(hash);
+
+    if (found != checkpoints_.end())
+        return &found->second;
+    if (cacheDir_.empty())
+        return 0;
+
+    std::string     path = cachePath(hash);
+    std::ifstream   file(path, std::ios::binary);
+    std::string     data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    char const      *it = data.data();
+    char const      *end = it + data.size();
+    checkpoint_t    checkpoint;
+
+    if (data.size() < sizeof(checkpointMagic) + 2 * sizeof(uint64_t)
+        || std::memcmp(it, checkpointMagic, sizeof(checkpointMagic)) != 0)
+        return 0;
+    it += sizeof(checkpointMagic);
+    std::memcpy(&checkpoint.previous, it, sizeof(uint64_t));
+    it += sizeof(uint64_t);
+    std::memcpy(&checkpoint.keep, it, sizeof(uint64_t));
+    it += sizeof(uint64_t);
+    if (!readString(it, end, checkpoint.output) || !Transcript::valid(checkpoint.output))
+        return 0;
+    checkpoint.snapshot.assign(it, end);
+    utime(path.c_str(), 0);
+    return &(checkpoints_[hash] = std::move(checkpoint));
+}
+
+void        Incremental::store(uint64_t hash, checkpoint_t & checkpoint)
+{
+    if (checkpoints_.count(hash))
+        return ;
+    checkpoints_[hash] = checkpoint;
+    if (cacheDir_.empty())
+        return ;
+
+    std::string buffer(checkpointMagic, sizeof(checkpointMagic));
+    std::string path = cachePath(hash);
+    std::string tmpPath = path + ".tmp";
+
+    buffer.append(reinterpret_cast<char const *>(&checkpoint.previous), sizeof(uint64_t));
+    buffer.append(reinterpret_cast<char const *>(&checkpoint.keep), sizeof(uint64_t));
+    appendString(buffer, checkpoint.output);
+    buffer += checkpoint.snapshot;
+
+    FILE    *file = std::fopen(tmpPath.c_str(), "wb");
+
+    if (!file)
+        throw Snapshot::WriteErrorException();
+    bool    written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+
+    if (std::fclose(file) != 0 || !written || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        throw Snapshot::WriteErrorException();
+    }
+}
+
+struct  cached_t
+{
+    struct timespec     used;
+    off_t               size;
+    std::string         path;
+};
+
+// Removes checkpoint files until the directory fits: other versions' first,
+// least recently written or resumed from first, then this version's chain
+// from its end, since every later checkpoint needs the ones before it.
+void        Incremental::evict(std::vector<boundary_t> const & marks) const
+{
+    DIR                     *handle = opendir(cacheDir_.c_str());
+    size_t const            suffix = sizeof(checkpointSuffix) - 1;
+    std::set<std::string>   chain;
+    std::vector<cached_t>   stale;
+    uint64_t                total = 0;
+
+    if (!handle)
+        return ;
+    for (boundary_t const & mark : marks)
+        chain.insert(cachePath(mark.hash));
+    while (struct dirent * found = readdir(handle))
+    {
+        std::string     name = found->d_name;
+        struct stat     info;
+
+        if (name.size() <= suffix || name.compare(name.size() - suffix, suffix, checkpointSuffix))
+            continue ;
+        name = cacheDir_ + "/" + name;
+        if (stat(name.c_str(), &info) != 0)
+            continue ;
+        total += info.st_size;
+        if (!chain.count(name))
+            stale.push_back(cached_t{ info.st_mtim, info.st_size, name });
+    }
+    closedir(handle);
+    std::sort(stale.begin(), stale.end(), [](cached_t const & a, cached_t const & b)
+    {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (size_t i = 0; i < stale.size() && total > maxBytes_; i++)
+        if (std::remove(stale[i].path.c_str()) == 0)
+            total -= stale[i].size;
+    for (auto mark = marks.rbegin(); mark != marks.rend() && total > maxBytes_; ++mark)
+    {
+        std::string     path = cachePath(mark->hash);
+        struct stat     info;
+
+        if (stat(path.c_str(), &info) == 0 && std::remove(path.c_str()) == 0)
+            total -= info.st_size;
+    }
+}
+
+bool        Incremental::resume(boundary_t const & mark, AVM & vm)
+{
+    std::vector<std::pair<uint64_t, checkpoint_t const *>>  chain;
+
+    for (uint64_t hash = mark.hash; hash; hash = chain.back().second->previous)
+    {
+        checkpoint_t const  *checkpoint = find(hash);
+
+        if (!checkpoint || chain.size() > checkpoints_.size())
+            return false;
+        chain.push_back(std::make_pair(hash, checkpoint));
+    }
+    try
+    {
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        {
+            checkpoint_t const  &checkpoint = *it->second;
+
+            if (checkpoint.keep > vm.vmStack.size())
+                throw Snapshot::BadSnapshotException();
+            vm.vmStack.drop(vm.vmStack.size() - checkpoint.keep);
+            vm.programHash = it->first;
+            Snapshot::decode(checkpoint.snapshot.data(), checkpoint.snapshot.data() + checkpoint.snapshot.size(), vm);
+        }
+    }
+    catch (std::exception const &)
+    {
+        vm.vmStack.drop(vm.vmStack.size());
+        vm.loops.clear();
+        vm.pc = 0;
+        return false;
+    }
+    vm.vmStack.resetLowWater();
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        Transcript::replay(it->second->output, *vm.out, *vm.err);
+    return true;
+}
+
+eRunStatus  Incremental::run(std::string const & source, program_t & program, AVM & vm)
+{
+    std::vector<boundary_t>     marks;
+    Transcript                  transcript;
+    uint64_t                    previous = 0;
+    size_t                      next;
+    eRunStatus                  status;
+
+    boundaries(source, program, marks);
+    for (next = marks.size(); next && !resume(marks[next - 1], vm); next--)
+        ;
+    resumedAt_ = next ? marks[next - 1].line : 0;
+    previous = next ? marks[next - 1].hash : 0;
+    TypeInference(program).annotate(vm.getPc(), !next);
+
+    transcript.attach(vm);
+    for (;;)
+    {
+        vm.breakpoint = next < marks.size() ? marks[next].pc : SIZE_MAX;
+        status = vm.run(program);
+        if (status != Yielded)
+            break ;
+
+        // Operands below the lowest depth reached since the last checkpoint
+        // are still the ones it saved
+        checkpoint_t    checkpoint{ previous, vm.vmStack.lowWater(), transcript.data(), std::string() };
+
+        vm.programHash = marks[next].hash;
+        Snapshot::encode(checkpoint.snapshot, vm, checkpoint.keep);
+        store(marks[next].hash, checkpoint);
+        vm.vmStack.resetLowWater();
+        previous = marks[next++].hash;
+        transcript.clear();
+    }
+    transcript.detach(vm);
+    vm.breakpoint = SIZE_MAX;
+    if (!cacheDir_.empty())
+        evict(marks);
+
+    // Only this version's chain is worth keeping in memory
+    std::map<uint64_t, checkpoint_t>    kept;
+
+    for (boundary_t const & mark : marks)
+    {
+        auto    found = checkpoints_.find(mark.hash);
+
+        if (found != checkpoints_.end())
+            kept[mark.hash] = std::move(found->second);
+    }
+    checkpoints_.swap(kept);
+    return status;
+}
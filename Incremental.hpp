@@ -0,0 +1,64 @@
+#ifndef INCREMENTAL_HPP
+# define INCREMENTAL_HPP
+
+#include "AVM.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+// Prefix checkpoints for rerunning an edited source. Every `interval` source
+// lines the VM is stopped the first time it reaches the first instruction
+// past them, and its state is kept with the output printed since the
+// previous checkpoint, keyed by a hash of the source text up to there. Only
+// lines whose prefix cannot jump or skip past them are used, so that state
+// depends on the prefix alone. A checkpoint holds the depth of the stack it
+// shares with the previous one and a snapshot of the operands above it, so
+// a later run starts from the last checkpoint whose prefix is unchanged by
+// replaying the chain up to it, output included. Checkpoints live in memory
+// and, given a cache directory, one file each, which is trimmed back to
+// maxBytes after every run.
+
+class Incremental
+{
+
+    struct  checkpoint_t
+    {
+        uint64_t            previous;   // hash of the checkpoint before, 0 for the start
+        uint64_t            keep;       // operands at the bottom of the stack shared with it
+        std::string         output;     // a Transcript
+        std::string         snapshot;   // the operands above keep
+    };
+
+    struct  boundary_t
+    {
+        size_t              pc;
+        size_t              line;
+        uint64_t            hash;
+    };
+
+    size_t                              interval_;
+    std::string                         cacheDir_;
+    uint64_t                            maxBytes_;
+    std::map<uint64_t, checkpoint_t>    checkpoints_;
+    size_t                              resumedAt_;
+
+    void                    boundaries  (std::string const & source, program_t const & program,
+                                         std::vector<boundary_t> & marks) const;
+    checkpoint_t const      *find       (uint64_t hash);
+    void                    store       (uint64_t hash, checkpoint_t & checkpoint);
+    bool                    resume      (boundary_t const & mark, AVM & vm);
+    std::string             cachePath   (uint64_t hash) const;
+    void                    evict       (std::vector<boundary_t> const & marks) const;
+
+public:
+
+    Incremental(size_t interval, std::string const & cacheDir, uint64_t maxBytes);
+    Incremental(Incremental const &) = delete;
+    Incremental & operator = (Incremental const &) = delete;
+
+    eRunStatus  run         (std::string const & source, program_t & program, AVM & vm);
+    size_t      resumedAt   (void) const { return resumedAt_; }
+
+};
+
+#endif
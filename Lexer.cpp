@@ -3,36 +3,298 @@
 //
 
 #include "Lexer.hpp"
-#include <sstream>
+#include "Probes.hpp"
+#include <cstdlib>
 #include <limits>
+#include <unistd.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
-const char* const       Lexer::integralArgTypes[]   = { "int8", "int16",
-                                                        "int32", "int64"        };
+constexpr const char    *Lexer::instructions[];
 
-const char* const       Lexer::floatingArgTypes[]   = { "float", "double"       };
+constexpr const char    *Lexer::argTypes[];
 
-const char* const       Lexer::instrWithArg[]       = { "push", "assert"        };
+static constexpr size_t     keywordLength(const char *word)
+{
+    return *word ? 1 + keywordLength(word + 1) : 0;
+}
+
+template <unsigned A, unsigned B, unsigned Mask>
+static constexpr unsigned   keywordHash(const char *word, size_t length)
+{
+    return length ? (static_cast<unsigned char>(word[0]) * A + static_cast<unsigned char>(word[length - 1]) * B
+                     + static_cast<unsigned>(length)) & Mask : 0;
+}
 
-const char* const       Lexer::instrWithoutArg[]    = { "pop", "dump", "add",
-                                                        "sub", "mul", "div",
-                                                        "mod", "print", "exit"  };
+template <unsigned A, unsigned B, unsigned Mask, size_t N>
+static constexpr bool       uniqueHashes(const char * const (&words)[N], size_t i = 0, size_t j = 1)
+{
+    return i + 1 >= N ? true
+         : j >= N ? uniqueHashes<A, B, Mask>(words, i + 1, i + 2)
+         : keywordHash<A, B, Mask>(words[i], keywordLength(words[i])) != keywordHash<A, B, Mask>(words[j], keywordLength(words[j]))
+           && uniqueHashes<A, B, Mask>(words, i, j + 1);
+}
 
-static void checkIntegral(  std::string::iterator begin, const char *underLimit, const char *upperLimit)
+template <unsigned A, unsigned B, unsigned Mask>
+struct  keyword_table_t
 {
-    bool    isNegative = false;
+    const char * const  *words;
+    signed char         slots[Mask + 1];
+
+    template <size_t N>
+    explicit keyword_table_t(const char * const (&list)[N]) : words(list)
+    {
+        std::memset(slots, -1, sizeof(slots));
+        for (size_t i = 0; i < N; i++)
+            slots[keywordHash<A, B, Mask>(list[i], keywordLength(list[i]))] = static_cast<signed char>(i);
+    }
+
+    int     find(const char *word, size_t length) const
+    {
+        int index = slots[keywordHash<A, B, Mask>(word, length)];
+
+        if (index < 0 || std::strncmp(words[index], word, length) || words[index][length])
+            return -1;
+        return index;
+    }
+};
+
+static_assert(uniqueHashes<3, 7, 63>(Lexer::instructions), "instruction keywords collide, retune their hash");
+static_assert(uniqueHashes<1, 3, 7>(Lexer::argTypes), "argument types collide, retune their hash");
+
+static const keyword_table_t<3, 7, 63>  instructionTable(Lexer::instructions);
+static const keyword_table_t<1, 3, 7>   argTypeTable(Lexer::argTypes);
+
+static inline bool  isSpace(char c)
+{
+    return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+}
+
+static inline bool  isDigit(char c)
+{
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+static inline bool  isWordChar(char c)
+{
+    return isDigit(c) || static_cast<unsigned char>((c | 0x20) - 'a') < 26 || c == '_';
+}
+
+// One pass over the source marking its structural characters: bit i of
+// marks is set when begin[i] is '\n', ';', '(' or ')'. Returns how many
+// lines there are.
+static size_t       classify(char const *begin, char const *end, std::vector<uint64_t> & marks)
+{
+    size_t  size = end - begin, done = 0, lines = 1;
+
+    marks.assign(size / 64 + 1, 0);
+#ifdef __SSE2__
+    __m128i const   newline = _mm_set1_epi8('\n');
+    __m128i const   semicolon = _mm_set1_epi8(';');
+    __m128i const   parenthesis = _mm_set1_epi8(')');
+    __m128i const   one = _mm_set1_epi8(1);
 
-    if (*begin == '-') isNegative = true;
-    if (*begin == '-' || *begin == '+') begin++;
+    for (; size - done >= 64; done += 64)
+    {
+        uint64_t    structural = 0, newlines = 0;
 
-    const char *argContent = begin.base();
+        for (size_t part = 0; part < 64; part += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(begin + done + part));
+            __m128i isNewline = _mm_cmpeq_epi8(chunk, newline);
+            // '(' | 1 == ')'
+            __m128i isMark = _mm_or_si128(_mm_or_si128(isNewline, _mm_cmpeq_epi8(chunk, semicolon)),
+                                          _mm_cmpeq_epi8(_mm_or_si128(chunk, one), parenthesis));
+
+            structural |= static_cast<uint64_t>(_mm_movemask_epi8(isMark)) << part;
+            newlines |= static_cast<uint64_t>(_mm_movemask_epi8(isNewline)) << part;
+        }
+        marks[done / 64] = structural;
+        lines += __builtin_popcountll(newlines);
+    }
+#endif
+    for (; done < size; done++)
+        if (begin[done] == '\n' || begin[done] == ';' || (begin[done] | 1) == ')')
+        {
+            marks[done / 64] |= static_cast<uint64_t>(1) << (done % 64);
+            lines += begin[done] == '\n';
+        }
+    return lines;
+}
 
-    auto    limitLen = std::strlen(isNegative ? underLimit : upperLimit),
-            contentLen = std::strlen(argContent);
+// Walks the marks of a classified source in order, one line at a time
+struct  markCursor_t
+{
+    char const                  *base;
+    char const                  *end;
+    std::vector<uint64_t> const &marks;
+    size_t                      block;
+    uint64_t                    pending;
+
+    markCursor_t(char const *base, char const *end, std::vector<uint64_t> const & marks)
+        : base(base), end(end), marks(marks), block(0), pending(marks[0]) {}
+
+    char const  *next(void)
+    {
+        while (!pending)
+        {
+            if (++block == marks.size())
+                return end;
+            pending = marks[block];
+        }
+
+        size_t  bit = __builtin_ctzll(pending);
+
+        pending &= pending - 1;
+        return base + block * 64 + bit;
+    }
+
+    // The line starting at begin, up to its newline or the end of the source
+    void        line(char const *begin, Lexer::line_t & line)
+    {
+        char const  *mark;
+
+        line.begin = begin;
+        line.comment = line.open = line.close = 0;
+        while ((mark = next()) != end && *mark != '\n')
+        {
+            if (line.comment)
+                continue ;
+            if (*mark == ';')
+                line.comment = mark;
+            else if (*mark == '(' && !line.open)
+                line.open = mark;
+            else if (*mark == ')' && line.open && !line.close)
+                line.close = mark;
+        }
+        line.end = mark;
+    }
+};
+
+static inline char const *skipSpace(char const *it, char const *end)
+{
+    while (it < end && isSpace(*it))
+        it++;
+    return it;
+}
+
+static bool isIdentifier(char const *it, char const *end)
+{
+    if (it == end || isDigit(*it))
+        return false;
+    return std::all_of(it, end, isWordChar);
+}
+
+static uint64_t parseCount(char const *begin, char const *end)
+{
+    if (!std::all_of(begin, end, isDigit))
+        throw Lexer::BadArgumentException();
+
+    uint64_t    count = 0;
+
+    for (char const *it = begin; it < end; it++)
+    {
+        if (count > (std::numeric_limits<uint64_t>::max() - (*it - '0')) / 10)
+            throw Lexer::OverflowErrorException();
+        count = count * 10 + (*it - '0');
+    }
+    return count;
+}
+
+// Cuts a trailing repeat count ("push int8(0) 100", "pop 100") off the line.
+static uint64_t splitCount(char const *from, char const *& end)
+{
+    char const  *last = end;
+
+    while (last > from && isSpace(last[-1])) last--;
+
+    char const  *digits = last;
+
+    while (digits > from && isDigit(digits[-1])) digits--;
+
+    if (digits == last || (digits > from && !isSpace(digits[-1])))
+        return 1;
+
+    uint64_t    count = parseCount(digits, last);
+
+    while (digits > from && isSpace(digits[-1])) digits--;
+    end = digits;
+    return count;
+}
+
+static bool unrolledSize(program_t const & program, size_t begin, size_t end, size_t limit, size_t & size)
+{
+    size = 0;
+    for (size_t pc = begin; pc < end; pc++)
+    {
+        instruction_t const *instr = program[pc].get();
+
+        if (instr->opcode >= OpJmp && instr->opcode <= OpJnz)
+            return false;
+        if (instr->opcode == OpRepeat)
+        {
+            size_t  body;
+
+            if (!unrolledSize(program, pc + 1, instr->target, limit, body))
+                return false;
+            if (body && instr->count > (limit - size) / body)
+                return false;
+            size += body * instr->count;
+            pc = instr->target;
+        }
+        else if ((instr->opcode == OpPop ? 1 : instr->count) > limit - size)
+            return false;
+        else
+            size += instr->opcode == OpPop ? 1 : instr->count;
+    }
+    return true;
+}
+
+static void unrollRange(program_t const & program, size_t begin, size_t end, program_t & unrolled)
+{
+    for (size_t pc = begin; pc < end; pc++)
+    {
+        instruction_t const *instr = program[pc].get();
+
+        if (instr->opcode == OpRepeat)
+        {
+            for (uint64_t i = 0; i < instr->count; i++)
+                unrollRange(program, pc + 1, instr->target, unrolled);
+            pc = instr->target;
+        }
+        else
+        {
+            // pop N fails without popping anything when the stack is too
+            // short, so it stays one instruction; push N is N pushes
+            uint64_t    copies = instr->opcode == OpPop ? 1 : instr->count;
+
+            for (uint64_t i = 0; i < copies; i++)
+            {
+                unrolled.push_back(std::unique_ptr<instruction_t>(new instruction_t(instr->name, instr->opcode, instr->line,
+                                                                  instr->arg ? new arg_t(*instr->arg) : 0)));
+                if (instr->opcode == OpPop)
+                    unrolled.back()->count = instr->count;
+            }
+        }
+    }
+}
+
+static void checkIntegral(char const *begin, char const *end, const char *underLimit, const char *upperLimit)
+{
+    bool    isNegative = false;
+
+    if (begin < end && *begin == '-') isNegative = true;
+    if (begin < end && (*begin == '-' || *begin == '+')) begin++;
+
+    const char  *limit = isNegative ? underLimit : upperLimit;
+    size_t      limitLen = std::strlen(limit),
+                contentLen = end - begin;
 
     if (contentLen < limitLen)
         return ;
 
-    else if (contentLen == limitLen && strcmp(argContent, isNegative ? underLimit : upperLimit) <= 0)
+    else if (contentLen == limitLen && std::memcmp(begin, limit, limitLen) <= 0)
         return ;
 
     else
@@ -44,102 +306,125 @@ static void checkIntegral(  std::string::iterator begin, const char *underLimit,
     }
 }
 
-static void checkInt8(std::string argContent) { checkIntegral(argContent.begin(), "128", "127"); }
-
-static void checkInt16(std::string argContent) { checkIntegral(argContent.begin(), "32768", "32767"); }
-
-static void checkInt32(std::string argContent) { checkIntegral(argContent.begin(), "2147483648", "2147483647"); }
-
-static void checkInt64(std::string argContent) { checkIntegral(argContent.begin(), "9223372036854775808", "9223372036854775807"); }
-
-static void checkFloat(std::string argContent)
+// Accepts what operator>> would: the longest prefix shaped like a decimal
+// number has to convert entirely and to a finite value, and whatever
+// follows it is ignored.
+template <typename T>
+static void checkFloating(char const *begin, char const *end, T (*convert)(const char *, char **))
 {
-    std::stringstream   stream(argContent);
+    char const  *it = begin;
+    bool        mantissa = false;
+
+    if (it < end && (*it == '-' || *it == '+')) it++;
+    for (; it < end && isDigit(*it); it++) mantissa = true;
+    if (it < end && *it == '.')
+        for (it++; it < end && isDigit(*it); it++) mantissa = true;
+    if (mantissa && it < end && (*it == 'e' || *it == 'E'))
+    {
+        it++;
+        if (it < end && (*it == '-' || *it == '+')) it++;
+        while (it < end && isDigit(*it)) it++;
+    }
 
-    float fValue;
+    size_t      length = it - begin;
+    char        local[64];
+    std::string spill;
+    char const  *text = local;
 
-    stream >> fValue;
+    if (length < sizeof(local))
+    {
+        std::memcpy(local, begin, length);
+        local[length] = '\0';
+    }
+    else
+        text = (spill = std::string(begin, it)).c_str();
 
-    if (fValue == std::numeric_limits<float>::infinity())
-        throw Lexer::OverflowErrorException();
-    if (fValue == -(std::numeric_limits<float>::infinity()))
-        throw Lexer::UnderflowErrorException();
+    char    *stop;
+    T       value = convert(text, &stop);
 
-    if (stream.fail())
+    if (!length || stop != text + length
+        || value == std::numeric_limits<T>::infinity() || value == -std::numeric_limits<T>::infinity())
         throw Lexer::BadArgumentException();
 }
 
-static void checkDouble(std::string argContent)
-{
-    std::stringstream   stream(argContent);
+static void checkInt8(char const *begin, char const *end) { checkIntegral(begin, end, "128", "127"); }
 
-    double dValue;
+static void checkInt16(char const *begin, char const *end) { checkIntegral(begin, end, "32768", "32767"); }
 
-    stream >> dValue;
+static void checkInt32(char const *begin, char const *end) { checkIntegral(begin, end, "2147483648", "2147483647"); }
 
-    if (dValue == std::numeric_limits<double>::infinity())
-        throw Lexer::OverflowErrorException();
-    if (dValue == -(std::numeric_limits<double>::infinity()))
-        throw Lexer::UnderflowErrorException();
+static void checkInt64(char const *begin, char const *end) { checkIntegral(begin, end, "9223372036854775808", "9223372036854775807"); }
 
-    if (stream.fail())
-        throw Lexer::BadArgumentException();
-}
+static void checkFloat(char const *begin, char const *end) { checkFloating<float>(begin, end, std::strtof); }
 
-void    (*Lexer::checkLimit[6])(std::string) = {    checkInt8,
-                                                    checkInt16,
-                                                    checkInt32,
-                                                    checkInt64,
-                                                    checkFloat,
-                                                    checkDouble  };
+static void checkDouble(char const *begin, char const *end) { checkFloating<double>(begin, end, std::strtod); }
+
+void    (*Lexer::checkLimit[6])(char const *, char const *) = {    checkInt8,
+                                                            checkInt16,
+                                                            checkInt32,
+                                                            checkInt64,
+                                                            checkFloat,
+                                                            checkDouble  };
 
 void Lexer::setVmStream(std::istream *vmStream)
 {
     vmStream_ = vmStream;
 }
 
-Lexer::Lexer(std::list<std::unique_ptr<instruction_t> > &instrList, std::istream *stream)
-    : instrList(instrList), vmStream_(stream) {}
+const char  *Lexer::instrName(int opcode)
+{
+    if (opcode >= 0 && opcode <= OpClear)
+        return instructions[opcode];
+    return "?";
+}
 
-std::string Lexer::getIntegralContent(std::string::iterator it, std::string::iterator end)
+void Lexer::setParamsAllowed(bool allowParams)
 {
-    std::string content;
+    allowParams_ = allowParams;
+}
 
-    while (std::iswspace(*it)) it++;
+Lexer::Lexer(program_t &instrList, std::istream *stream)
+    : instrList(instrList), vmStream_(stream), allowParams_(false) {}
 
-    if (*it == '-' || *it == '+') content += *it++;
+// Checks that only spaces follow the closing parenthesis of an argument
+static void closeArgument(char const *it, char const *end)
+{
+    it = skipSpace(it, end);
 
-    while (!std::iswspace(*it) && *it != ')' && it < end)
-    {
-        if (!std::isdigit(*it))
-            throw BadArgumentException();
-        content += *it++;
-    }
+    if (it == end || *it != ')')
+        throw Lexer::BadArgumentException();
 
-    while (std::iswspace(*it)) it++;
+    if (skipSpace(it + 1, end) != end)
+        throw Lexer::ExtraSymbolException();
+}
 
-    if (*it != ')')
-        throw BadArgumentException();
-    it++;
+Lexer::span_t Lexer::getIntegralContent(char const *it, char const *close, char const *end)
+{
+    span_t  content;
 
-    while (std::iswspace(*it)) it++;
+    content.begin = it = skipSpace(it, end);
 
-    if (it != end)
-        throw ExtraSymbolException();
+    if (it < end && (*it == '-' || *it == '+')) it++;
 
+    for (; it < close && !isSpace(*it); it++)
+        if (!isDigit(*it))
+            throw BadArgumentException();
+
+    content.end = it;
+    closeArgument(it, end);
     return content;
 }
 
-std::string Lexer::getFloatingContent(std::string::iterator it, std::string::iterator end)
+Lexer::span_t Lexer::getFloatingContent(char const *it, char const *close, char const *end)
 {
-    size_t      dotCount = 0;
-    std::string content;
+    size_t  dotCount = 0;
+    span_t  content;
 
-    while (std::iswspace(*it)) it++;
+    content.begin = it = skipSpace(it, end);
 
-    if (*it == '-' || *it == '+') content += *it++;
+    if (it < end && (*it == '-' || *it == '+')) it++;
 
-    while (!std::iswspace(*it) && *it != ')' && it < end)
+    for (; it < close && !isSpace(*it); it++)
     {
         if (*it == '.')
         {
@@ -148,123 +433,292 @@ std::string Lexer::getFloatingContent(std::string::iterator it, std::string::ite
             else
                 dotCount++;
         }
-        else if (!std::isdigit(*it) && dotCount)
+        else if (!isDigit(*it) && dotCount)
             throw BadArgumentException();
-        content += *it++;
     }
 
-    while (std::iswspace(*it)) it++;
+    content.end = it;
+    closeArgument(it, end);
+    return content;
+}
 
-    if (*it != ')')
-        throw BadArgumentException();
+Lexer::span_t Lexer::getParamContent(char const *it, char const *end)
+{
+    span_t  content;
+
+    content.begin = it = skipSpace(it, end);
+    content.end = it;
+
+    if (it == end || *it != '$')
+        return content;
     it++;
 
-    while (std::iswspace(*it)) it++;
+    while (it < end && isWordChar(*it)) it++;
 
-    if (it != end)
-        throw ExtraSymbolException();
+    if (it - content.begin == 1 || isDigit(content.begin[1]))
+        throw BadArgumentException();
 
+    content.end = it;
+    closeArgument(it, end);
     return content;
 }
 
-arg_t*   Lexer::getArg(std::string::iterator it, std::string::iterator end)
+std::string Lexer::checkArgument(int type, std::string const & content)
+{
+    std::string argString(content + ")");
+    char const  *end = argString.data() + argString.size();
+    char const  *close = std::find(argString.data(), end, ')');
+    span_t      arg = type <= eOperandType::Int64 ? getIntegralContent(argString.data(), close, end)
+                                                  : getFloatingContent(argString.data(), close, end);
+
+    checkLimit[type](arg.begin, arg.end);
+    return std::string(arg.begin, arg.end);
+}
+
+arg_t*   Lexer::getArg(char const *it, char const *end, line_t const & line, bool allowParam)
 {
     if (it == end) throw MissingArgumentException();
 
-    std::string argTypeStr;
-    int         argTypeNb = 0;
+    char const  *open = line.open && line.open < end ? line.open : end;
+    char const  *close = line.close && line.close < end ? line.close : end;
+    char const  *typeBegin = it;
+
+    while (it < open && !isSpace(*it)) it++;
 
-    while (it < end && !std::iswspace(*it) && *it != '(') argTypeStr += *it++;
+    int         argTypeNb = argTypeTable.find(typeBegin, it - typeBegin);
 
-    while (std::iswspace(*it)) it++;
+    it = skipSpace(it, end);
 
     if (it == end || *it != '(') throw BadArgumentException();
 
-    for (const char* tmp : integralArgTypes)
+    span_t      param = getParamContent(it + 1, end);
+
+    if (param.begin != param.end && !allowParam)
+        throw UnboundParameterException();
+
+    if (argTypeNb < 0)
+        throw UnknownArgumentTypeException();
+
+    span_t      arg = param.begin != param.end ? param
+                    : argTypeNb <= Int64 ? getIntegralContent(it + 1, close, end)
+                                         : getFloatingContent(it + 1, close, end);
+
+    if (param.begin == param.end)
+        checkLimit[argTypeNb](arg.begin, arg.end);
+
+    std::string argString(arg.begin, arg.end);
+
+    return new arg_t(argTypeNb, argString);
+}
+
+void Lexer::collectInstr(char const *it, char const *end, line_t const & line, size_t lineNb)
+{
+    it = skipSpace(it, end);
+
+    char const  *nameBegin = it;
+
+    while (it < end && !isSpace(*it)) it++;
+
+    char const  *nameEnd = it;
+    int         opcode = instructionTable.find(nameBegin, it - nameBegin);
+
+    it = skipSpace(it, end);
+
+    if (opcode < 0 && nameEnd - nameBegin > 1 && nameEnd[-1] == ':' && isIdentifier(nameBegin, nameEnd - 1))
     {
-        if (argTypeStr == tmp) {
-            std::string argString = getIntegralContent(it + 1, end);
-            checkLimit[argTypeNb](argString);
-            return new arg_t(argTypeNb, argString);
-        }
-        argTypeNb++;
+        if (it != end)
+            throw Lexer::ExtraSymbolException();
+
+        label_t label = { instrList.size(), blocks_.empty() ? SIZE_MAX : blocks_.back() };
+
+        if (!labels_.insert(std::make_pair(std::string(nameBegin, nameEnd - 1), label)).second)
+            throw Lexer::DuplicateLabelException();
+        return ;
     }
+    if (opcode < 0)
+        throw Lexer::UnknownInstructionException();
+    if (opcode >= OpRepeat && opcode <= OpJnz)
+        return collectControl(opcode, it, end, lineNb);
+
+    uint64_t    count = 1;
 
-    for (const char* tmp : floatingArgTypes)
+    if (opcode == OpPush || opcode == OpPop)
+        count = splitCount(it, end);
+    if (opcode <= OpAssert)
     {
-        if (argTypeStr == tmp) {
-            std::string argString = getFloatingContent(it + 1, end);
-            Lexer::checkLimit[argTypeNb](argString);
-            return new arg_t(argTypeNb, argString);
-        }
-        argTypeNb++;
+        arg_t   *argument = getArg(it, end, line, allowParams_ && opcode == OpPush);
+        instrList.push_back(std::unique_ptr<instruction_t>(new instruction_t(instructions[opcode], opcode, lineNb, argument)));
+        instrList.back()->count = count;
+        return ;
     }
-    throw UnknownArgumentTypeException();
+    if (it != end)
+        throw Lexer::ExtraSymbolException();
+    instrList.push_back(std::unique_ptr<instruction_t>(new instruction_t(instructions[opcode], opcode, lineNb)));
+    instrList.back()->count = count;
 }
 
-void Lexer::collectInstr(std::string &line)
+void Lexer::collectControl(int opcode, char const *it, char const *end, size_t lineNb)
 {
-    std::string             instrName;
-    std::string::iterator   it = line.begin();
-    std::string::iterator   end = line.end();
+    std::unique_ptr<instruction_t>  instr(new instruction_t(instructions[opcode], opcode, lineNb));
+    char const                      *wordBegin = it;
+
+    while (it < end && !isSpace(*it)) it++;
+
+    char const                      *wordEnd = it;
+
+    if (skipSpace(it, end) != end || (opcode == OpEnd && wordBegin != wordEnd))
+        throw Lexer::ExtraSymbolException();
+    if (opcode == OpEnd)
+    {
+        if (blocks_.empty())
+            throw Lexer::UnmatchedEndException();
+        instr->target = blocks_.back();
+        instrList[blocks_.back()]->target = instrList.size();
+        blocks_.pop_back();
+    }
+    else if (wordBegin == wordEnd)
+        throw Lexer::MissingArgumentException();
+    else if (opcode == OpRepeat)
+    {
+        instr->count = parseCount(wordBegin, wordEnd);
+        blocks_.push_back(instrList.size());
+    }
+    else if (!isIdentifier(wordBegin, wordEnd))
+        throw Lexer::BadArgumentException();
+    else
+        jumps_.push_back(jump_t{ instrList.size(), blocks_.empty() ? SIZE_MAX : blocks_.back(),
+                                 std::string(wordBegin, wordEnd) });
+    instrList.push_back(std::move(instr));
+}
 
-    while (std::iswspace(*it)) it++;
-    while (!std::iswspace(*it) && it < end) instrName += *it++;
-    while (std::iswspace(*it)) it++;
+void Lexer::resolveJumps()
+{
+    for (size_t block : blocks_)
+    {
+        std::cerr << "Error on line " << instrList[block]->line << " " << UnterminatedRepeatException().what() << std::endl;
+        AVM_PROBE1(lex_error, instrList[block]->line);
+        AVM::lexerError = true;
+    }
+    for (jump_t const & jump : jumps_)
+    {
+        auto    label = labels_.find(jump.label);
 
-    for (const char* tmp : instrWithArg)
-        if (instrName == tmp)
+        try
         {
-            arg_t   *argument = getArg(it, end);
-            instrList.push_back(std::unique_ptr<instruction_t>(new instruction_t(tmp, argument)));
-            return ;
+            if (label == labels_.end())
+                throw UndefinedLabelException();
+            if (label->second.block != jump.block)
+                throw CrossBlockJumpException();
+            instrList[jump.index]->target = label->second.target;
         }
-    for (const char* tmp : instrWithoutArg)
-        if (instrName == tmp)
+        catch (std::exception & error)
         {
-            while (std::iswspace(*it)) it++;
-            if (it != end)
-                throw Lexer::ExtraSymbolException();
-            instrList.push_back(std::unique_ptr<instruction_t>(new instruction_t(tmp)));
-            return ;
+            std::cerr << "Error on line " << instrList[jump.index]->line << " " << error.what() << std::endl;
+            AVM_PROBE1(lex_error, instrList[jump.index]->line);
+            AVM::lexerError = true;
         }
-    throw Lexer::UnknownInstructionException();
+    }
+}
+
+bool Lexer::isStraight(program_t const & program)
+{
+    return std::none_of(program.begin(), program.end(),
+                        [](std::unique_ptr<instruction_t> const & instr)
+                        { return (instr->opcode > OpExit && instr->opcode < OpDup) || (instr->count != 1 && instr->opcode != OpPop); });
+}
+
+bool Lexer::unroll(program_t const & program, program_t & unrolled, size_t limit)
+{
+    size_t  size;
+
+    if (!unrolledSize(program, 0, program.size(), limit, size))
+        return false;
+    unrolled.reserve(size);
+    unrollRange(program, 0, program.size(), unrolled);
+    return true;
+}
+
+bool Lexer::lexLine(line_t const & line, size_t lineNb)
+{
+    char const  *end = line.comment ? line.comment : line.end;
+    char const  *begin = skipSpace(line.begin, end);
+    bool        lastLine = line.comment && line.comment + 1 < line.end && line.comment[1] == ';';
+
+    try
+    {
+        if (begin != end)
+            collectInstr(begin, end, line, lineNb);
+    }
+    catch (std::exception & error)
+    {
+        std::cerr << "Error on line " << lineNb << " " << error.what() << std::endl;
+        AVM_PROBE1(lex_error, lineNb);
+        AVM::lexerError = true;
+    }
+    return !lastLine;
 }
 
 void Lexer::readBuf( void )
 {
-    bool        endRead = false;
-    size_t      commentPosition = 0;
     size_t      lineNb = 0;
-    std::string line;
 
-    while (!endRead)
+    AVM_PROBE0(lex_start);
+    if (vmStream_ == &std::cin && isatty(STDIN_FILENO))
     {
-        endRead = (std::getline(*vmStream_, line).eof());
-        lineNb++;
+        bool        endRead = false;
+        std::string line;
 
-        try
+        while (!endRead)
         {
-            if ((commentPosition = line.find(';')) != std::string::npos
-                && line[commentPosition + 1] != ';')
-                line.resize(commentPosition);
-            else if (commentPosition != std::string::npos)
-            {
-                line.resize(commentPosition);
+            std::vector<uint64_t>   marks;
+            line_t                  marked;
 
-                if (!std::all_of(line.begin(), line.end(), isspace))
-                    collectInstr(line);
+            endRead = (std::getline(*vmStream_, line).eof());
+            classify(line.data(), line.data() + line.size(), marks);
+            markCursor_t(line.data(), line.data() + line.size(), marks).line(line.data(), marked);
+            if (!lexLine(marked, ++lineNb))
                 break ;
-            }
-            if (!std::all_of(line.begin(), line.end(), isspace))
-                collectInstr(line);
-        }
-        catch (std::exception & error)
-        {
-            std::cerr << "Error on line " << lineNb << " " << error.what() << std::endl;
-            AVM::lexerError = true;
         }
+        resolveJumps();
+        AVM_PROBE2(lex_done, instrList.size(), AVM::lexerError);
+        return ;
+    }
+
+    std::string     buffer;
+    char            chunk[1 << 16];
+    std::streampos  start = vmStream_->tellg();
+
+    // A file is read in one go; pipes and terminals a chunk at a time
+    if (start != std::streampos(-1) && vmStream_->seekg(0, std::ios::end))
+    {
+        buffer.resize(static_cast<size_t>(vmStream_->tellg() - start));
+        vmStream_->seekg(start);
+        vmStream_->read(&buffer[0], buffer.size());
+        buffer.resize(vmStream_->gcount());
+    }
+    else
+        vmStream_->clear();
+    while (vmStream_->read(chunk, sizeof(chunk)) || vmStream_->gcount())
+        buffer.append(chunk, vmStream_->gcount());
+
+    char const              *it = buffer.data();
+    char const              *end = it + buffer.size();
+    std::vector<uint64_t>   marks;
+
+    instrList.reserve(instrList.size() + classify(it, end, marks));
+
+    markCursor_t            cursor(it, end, marks);
+    line_t                  line;
+
+    for (;;)
+    {
+        cursor.line(it, line);
+        if (!lexLine(line, ++lineNb) || line.end == end)
+            break ;
+        it = line.end + 1;
     }
+    resolveJumps();
+    AVM_PROBE2(lex_done, instrList.size(), AVM::lexerError);
 }
 
 const char *Lexer::OverflowErrorException::what() const throw() {
@@ -295,6 +749,30 @@ const char *Lexer::UnknownInstructionException::what() const throw() {
     return "unknown instruction!";
 }
 
+const char *Lexer::UnboundParameterException::what() const throw() {
+    return "named parameters are only allowed in push in batch mode!";
+}
+
 const char *Lexer::DivisionByZeroException::what() const throw() {
     return "division by zero !";
 }
+
+const char *Lexer::UndefinedLabelException::what() const throw() {
+    return "undefined label!";
+}
+
+const char *Lexer::DuplicateLabelException::what() const throw() {
+    return "label already defined!";
+}
+
+const char *Lexer::UnmatchedEndException::what() const throw() {
+    return "end without repeat!";
+}
+
+const char *Lexer::UnterminatedRepeatException::what() const throw() {
+    return "repeat without end!";
+}
+
+const char *Lexer::CrossBlockJumpException::what() const throw() {
+    return "jump into or out of a repeat block!";
+}
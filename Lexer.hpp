@@ -7,10 +7,11 @@
 
 #include <fstream>
 #include <iostream>
-#include <list>
+#include <vector>
 #include <string>
 #include <cstring>
 #include <algorithm>
+#include <map>
 #include "AVM.hpp"
 
 struct  arg_t
@@ -24,12 +25,17 @@ struct  arg_t
 
 struct  instruction_t
 {
-    std::string *name;
+    const char  *name;
     arg_t       *arg;
-
-    explicit instruction_t(const char *name, arg_t *arg = 0)
-        : name(new std::string(name)), arg(arg) {}
-    ~instruction_t() { delete name; delete arg; }
+    eOpcode     opcode;
+    size_t      line;
+    uint64_t    count = 1;
+    size_t      target = 0;
+    void        (AVM::*handler)(instruction_t const *) = 0;
+
+    instruction_t(const char *name, int opcode, size_t line, arg_t *arg = 0)
+        : name(name), arg(arg), opcode(static_cast<eOpcode>(opcode)), line(line) {}
+    ~instruction_t() { delete arg; }
 };
 
 struct Lexer
@@ -99,33 +105,128 @@ struct Lexer
         const char * what() const throw();
     };
 
-    Lexer(std::list<std::unique_ptr<instruction_t> >  &instrList, std::istream *stream = 0);
+    struct UnboundParameterException : std::exception
+    {
+        UnboundParameterException() = default;
+        ~UnboundParameterException() throw() = default;
+        UnboundParameterException&operator=(UnboundParameterException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct UndefinedLabelException : std::exception
+    {
+        UndefinedLabelException() = default;
+        ~UndefinedLabelException() throw() = default;
+        UndefinedLabelException&operator=(UndefinedLabelException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct DuplicateLabelException : std::exception
+    {
+        DuplicateLabelException() = default;
+        ~DuplicateLabelException() throw() = default;
+        DuplicateLabelException&operator=(DuplicateLabelException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct UnmatchedEndException : std::exception
+    {
+        UnmatchedEndException() = default;
+        ~UnmatchedEndException() throw() = default;
+        UnmatchedEndException&operator=(UnmatchedEndException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct UnterminatedRepeatException : std::exception
+    {
+        UnterminatedRepeatException() = default;
+        ~UnterminatedRepeatException() throw() = default;
+        UnterminatedRepeatException&operator=(UnterminatedRepeatException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct CrossBlockJumpException : std::exception
+    {
+        CrossBlockJumpException() = default;
+        ~CrossBlockJumpException() throw() = default;
+        CrossBlockJumpException&operator=(CrossBlockJumpException&) = delete;
+        const char * what() const throw();
+    };
+
+    // A line of the source, up to its newline, and where its structural
+    // characters are, 0 when it has none: the first ';', the first '(' before
+    // it and the first ')' after that
+    struct  line_t
+    {
+        char const      *begin;
+        char const      *end;
+        char const      *comment;
+        char const      *open;
+        char const      *close;
+    };
+
+    Lexer(program_t &instrList, std::istream *stream = 0);
 
     void                                        setVmStream(std::istream *vmStream);
+    void                                        setParamsAllowed(bool allowParams);
     void                                        readBuf();
 
+    static std::string                          checkArgument(int type, std::string const & content);
+    static const char                           *instrName(int opcode);
+    static bool                                 isStraight(program_t const & program);
+    static bool                                 unroll(program_t const & program, program_t & unrolled, size_t limit);
+
     ~Lexer()                                    = default;
 
     Lexer &operator = (const Lexer &object)     = delete;
 
-    static const char* const                    instrWithArg[];
-    static const char* const                    instrWithoutArg[];
-    static const char* const                    floatingArgTypes[];
-    static const char* const                    integralArgTypes[];
+    static constexpr const char                 *instructions[] = { "push", "assert", "pop", "dump", "add", "sub",
+                                                                    "mul", "div", "mod", "print", "exit", "repeat",
+                                                                    "end", "jmp", "jz", "jnz", "dup", "swap", "over",
+                                                                    "rot", "clear" };
+    static constexpr const char                 *argTypes[] = { "int8", "int16", "int32", "int64", "float", "double" };
 
 private:
 
     Lexer()                                     = default;
 
-    void                                        collectInstr(std::string & line);
-    arg_t                                       *getArg(std::string::iterator it, std::string::iterator end);
-    std::string                                 getIntegralContent(std::string::iterator it, std::string::iterator end);
-    std::string                                 getFloatingContent(std::string::iterator it, std::string::iterator end);
+    struct  label_t
+    {
+        size_t          target;
+        size_t          block;
+    };
+
+    struct  jump_t
+    {
+        size_t          index;
+        size_t          block;
+        std::string     label;
+    };
+
+    // Part of the line being lexed, which stays in the source buffer
+    struct  span_t
+    {
+        char const      *begin;
+        char const      *end;
+    };
+
+    bool                                        lexLine(line_t const & line, size_t lineNb);
+    void                                        resolveJumps(void);
+    void                                        collectControl(int opcode, char const *it, char const *end, size_t lineNb);
+    void                                        collectInstr(char const *it, char const *end, line_t const & line, size_t lineNb);
+    arg_t                                       *getArg(char const *it, char const *end, line_t const & line, bool allowParam);
+    static span_t                               getIntegralContent(char const *it, char const *close, char const *end);
+    static span_t                               getFloatingContent(char const *it, char const *close, char const *end);
+    static span_t                               getParamContent(char const *it, char const *end);
 
-    std::list<std::unique_ptr<instruction_t> >  &instrList;
+    program_t                                   &instrList;
     std::istream                                *vmStream_;
+    bool                                        allowParams_;
+    std::map<std::string, label_t>              labels_;
+    std::vector<jump_t>                         jumps_;
+    std::vector<size_t>                         blocks_;
 
-    static void                                 (*checkLimit[6])(std::string);
+    static void                                 (*checkLimit[6])(char const *begin, char const *end);
 
 };
 
@@ -5,6 +5,8 @@
 #include "Lexer.hpp"
 #include <sstream>
 #include <cmath>
+#include <limits>
+#include <cstring>
 
 template <typename T>
 struct Operand : IOperand
@@ -19,9 +21,13 @@ struct Operand : IOperand
         argValue_ = value;
     }
 
+    Operand(T value, std::string const & stringValue, int precision)
+        : argValue_(value), strValue_(stringValue), precision_(precision) {}
+
     int                 getPrecision()  const override { return precision_;                             }
     eOperandType        getType()       const override { return static_cast<eOperandType>(precision_);  }
     std::string const&  toString()      const override { return strValue_;                              }
+    T                   getValue()      const          { return argValue_;                              }
 
     bool        operator==(IOperand const & other) const override
     {
@@ -49,8 +55,32 @@ private:
 
 };
 
+template <typename T>
+uint64_t            operandBits(IOperand const * operand)
+{
+    uint64_t    bits = 0;
+    T           value = static_cast<Operand<T> const *>(operand)->getValue();
+
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
+
+inline uint64_t     operandBits(IOperand const * operand)
+{
+    switch (operand->getType())
+    {
+        case Int8:      return operandBits<int8_t>(operand);
+        case Int16:     return operandBits<int16_t>(operand);
+        case Int32:     return operandBits<int32_t>(operand);
+        case Int64:     return operandBits<int64_t>(operand);
+        case Float:     return operandBits<float>(operand);
+        case Double:    return operandBits<double>(operand);
+    }
+    return 0;
+}
+
 template<>
-bool        Operand<int8_t>::operator==(IOperand const & other) const
+inline bool Operand<int8_t>::operator==(IOperand const & other) const
 {
     return toString() == other.toString();
 }
@@ -110,16 +140,40 @@ IOperand const *    Operand<T>::operator*   ( IOperand const & other ) const
     return AVM::createOperand(static_cast<eOperandType>(precision_), std::to_string(tmp));
 }
 
+// Where an ops:: operation leaves the result of an operator: an operand made
+// from its text, or the exception of its error.
+struct  created
+{
+    eOperandType    type;
+    IOperand const  *operand;
+
+    explicit created(int precision) : type(static_cast<eOperandType>(precision)), operand(0) {}
+
+    void    fail(arith::eStatus error)
+    {
+        if (error == arith::DivisionByZero)
+            throw Lexer::DivisionByZeroException();
+        if (error == arith::Underflow)
+            throw Lexer::UnderflowErrorException();
+        throw Lexer::OverflowErrorException();
+    }
+
+    template <typename T>
+    void    value(T tmp) { operand = AVM::createOperand(type, std::to_string(tmp)); }
+
+    template <typename T>
+    void    quotient(int64_t tmp) { operand = AVM::createOperand(type, std::to_string(tmp)); }
+};
+
 template<typename T>
 IOperand const *    Operand<T>::operator/   ( IOperand const & other ) const
 {
     int64_t rightArgument;  std::stringstream   stream(other.toString());
                                                 stream >> rightArgument;
+    created result(precision_);
 
-    if (rightArgument == 0)
-        throw Lexer::DivisionByZeroException();
-
-    return AVM::createOperand(static_cast<eOperandType>(precision_), std::to_string((int64_t)(argValue_ / rightArgument)));
+    ops::divOp::apply<T>(argValue_, rightArgument, result);
+    return result.operand;
 }
 
 template<typename T>
@@ -131,11 +185,12 @@ IOperand const *    Operand<T>::operator%   ( IOperand const & other ) const
     if (rightArgument == 0)
         throw Lexer::DivisionByZeroException();
 
-    return AVM::createOperand(static_cast<eOperandType>(precision_), std::to_string(argValue_ % rightArgument));
+    return AVM::createOperand(static_cast<eOperandType>(precision_),
+                              std::to_string(rightArgument == -1 ? 0 : argValue_ % rightArgument));
 }
 
 template<>
-IOperand const *    Operand<float>::operator%   ( IOperand const & other ) const
+inline IOperand const *    Operand<float>::operator%   ( IOperand const & other ) const
 {
     float   rightArgument;  std::stringstream   stream(other.toString());
                                                 stream >> rightArgument;
@@ -147,7 +202,7 @@ IOperand const *    Operand<float>::operator%   ( IOperand const & other ) const
 }
 
 template<>
-IOperand const *    Operand<double>::operator%   ( IOperand const & other ) const
+inline IOperand const *    Operand<double>::operator%   ( IOperand const & other ) const
 {
     double   rightArgument;  std::stringstream  stream(other.toString());
                                                 stream >> rightArgument;
@@ -159,7 +214,7 @@ IOperand const *    Operand<double>::operator%   ( IOperand const & other ) cons
 }
 
 template<>
-IOperand const *    Operand<float>::operator/   ( IOperand const & other ) const
+inline IOperand const *    Operand<float>::operator/   ( IOperand const & other ) const
 {
     float   rightArgument, tmp; std::stringstream   stream(other.toString());
                                                     stream >> rightArgument;
@@ -178,7 +233,7 @@ IOperand const *    Operand<float>::operator/   ( IOperand const & other ) const
 }
 
 template<>
-IOperand const *    Operand<double>::operator/   ( IOperand const & other ) const
+inline IOperand const *    Operand<double>::operator/   ( IOperand const & other ) const
 {
     double   rightArgument, tmp; std::stringstream  stream(other.toString());
                                                     stream >> rightArgument;
@@ -197,7 +252,7 @@ IOperand const *    Operand<double>::operator/   ( IOperand const & other ) cons
 }
 
 template<>
-IOperand const *    Operand<float>::operator*   ( IOperand const & other ) const
+inline IOperand const *    Operand<float>::operator*   ( IOperand const & other ) const
 {
     float   rightArgument, tmp; std::stringstream   stream(other.toString());
                                                     stream >> rightArgument;
@@ -213,7 +268,7 @@ IOperand const *    Operand<float>::operator*   ( IOperand const & other ) const
 }
 
 template<>
-IOperand const *    Operand<double>::operator*   ( IOperand const & other ) const
+inline IOperand const *    Operand<double>::operator*   ( IOperand const & other ) const
 {
     double   rightArgument, tmp; std::stringstream  stream(other.toString());
                                                     stream >> rightArgument;
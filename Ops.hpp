@@ -0,0 +1,216 @@
+#ifndef OPS_HPP
+# define OPS_HPP
+
+#include "Arith.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// The statements of the Operand<T> operators on unboxed values: the left
+// operand as T, the right one as the long double the operator parses from
+// its text. A result goes to out.value<T>(result), or out.quotient<T>(text
+// value) for an integral quotient whose text its type may not hold; an
+// error goes to out.fail(status). Shared by the typed handlers and by the
+// runtime of compiled programs.
+
+namespace ops
+{
+
+// An operand kept unboxed: its type, the value of its text, and the text
+// itself once it is known. Integral results only get their text on demand.
+struct  slot_t
+{
+    eOperandType        type;
+    long double         exact;
+    char const          *literal;
+    std::string         text;
+};
+
+inline std::string  text(slot_t const & slot)
+{
+    if (slot.literal)
+        return slot.literal;
+    if (slot.type <= Int64)
+        return std::to_string(static_cast<int64_t>(slot.exact));
+    return slot.text;
+}
+
+// Leaves a result in a slot.
+struct  unboxed
+{
+    slot_t          &slot;
+    arith::eStatus  status;
+
+    explicit unboxed(slot_t & slot) : slot(slot), status(arith::Ok) {}
+
+    void    fail(arith::eStatus error) { status = error; }
+
+    template <typename T>
+    void    value(T tmp, typename std::enable_if<std::is_integral<T>::value>::type * = 0)
+    {
+        quotient<T>(tmp);
+    }
+
+    template <typename T>
+    void    value(T tmp, typename std::enable_if<std::is_floating_point<T>::value>::type * = 0)
+    {
+        slot.type = arith::type_of<T>::value;
+        slot.literal = 0;
+        slot.text = std::to_string(tmp);
+        slot.exact = std::strtold(slot.text.c_str(), 0);
+    }
+
+    template <typename T>
+    void    quotient(int64_t tmp)
+    {
+        slot.type = arith::type_of<T>::value;
+        slot.literal = 0;
+        slot.exact = tmp;
+    }
+};
+
+struct  addOp
+{
+    static char const       *name(void) { return "add"; }
+    static const bool       exactRight = false;
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double rightArgument, Out & out)
+    {
+        T   tmp = rightArgument; tmp += argValue;
+
+        if (rightArgument > 0 && argValue > 0 && tmp < 0)
+            return out.fail(arith::Overflow);
+        if (rightArgument < 0 && argValue < 0 && tmp < 0)
+            return out.fail(arith::Underflow);
+        out.template value<T>(tmp);
+    }
+};
+
+struct  subOp
+{
+    static char const       *name(void) { return "sub"; }
+    static const bool       exactRight = true;
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double rightArgument, Out & out)
+    {
+        T   tmp = argValue; tmp -= rightArgument;
+
+        if (argValue > 0 && rightArgument < 0 && tmp < 0)
+            return out.fail(arith::Overflow);
+        if (argValue < 0 && rightArgument > 0 && tmp > 0)
+            return out.fail(arith::Underflow);
+        out.template value<T>(tmp);
+    }
+};
+
+struct  mulOp
+{
+    static char const       *name(void) { return "mul"; }
+    static const bool       exactRight = false;
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double rightArgument, Out & out,
+                                  typename std::enable_if<std::is_integral<T>::value>::type * = 0)
+    {
+        T   tmp = rightArgument; tmp *= argValue;
+
+        if ((rightArgument < 0 && argValue < 0 && tmp / rightArgument != argValue)
+        ||  (rightArgument > 0 && argValue > 0 && tmp / rightArgument != argValue))
+            return out.fail(arith::Overflow);
+        if ((argValue < 0 || rightArgument < 0) && (tmp / rightArgument != argValue))
+            return out.fail(arith::Underflow);
+        out.template value<T>(tmp);
+    }
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double right, Out & out,
+                                  typename std::enable_if<std::is_floating_point<T>::value>::type * = 0)
+    {
+        T   rightArgument = right, tmp = argValue * rightArgument;
+
+        if (tmp == std::numeric_limits<T>::infinity())
+            return out.fail(arith::Overflow);
+        if (tmp == -std::numeric_limits<T>::infinity())
+            return out.fail(arith::Underflow);
+        out.template value<T>(tmp);
+    }
+};
+
+struct  divOp
+{
+    static char const       *name(void) { return "div"; }
+    static const bool       exactRight = false;
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double right, Out & out,
+                                  typename std::enable_if<std::is_integral<T>::value>::type * = 0)
+    {
+        int64_t rightArgument = right;
+
+        if (rightArgument == 0)
+            return out.fail(arith::DivisionByZero);
+        if (rightArgument == -1 && static_cast<int64_t>(argValue) == std::numeric_limits<int64_t>::min())
+            return out.fail(arith::Overflow);
+
+        int64_t quotient = (int64_t)(argValue / rightArgument);
+
+        out.template quotient<T>(quotient);
+    }
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double right, Out & out,
+                                  typename std::enable_if<std::is_floating_point<T>::value>::type * = 0)
+    {
+        T   rightArgument = right, tmp;
+
+        if (rightArgument == 0)
+            return out.fail(arith::DivisionByZero);
+        tmp = argValue / rightArgument;
+        if (tmp == std::numeric_limits<T>::infinity())
+            return out.fail(arith::Overflow);
+        if (tmp == -std::numeric_limits<T>::infinity())
+            return out.fail(arith::Underflow);
+        out.template value<T>(tmp);
+    }
+};
+
+struct  modOp
+{
+    static char const       *name(void) { return "mod"; }
+    static const bool       exactRight = false;
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double right, Out & out,
+                                  typename std::enable_if<std::is_integral<T>::value>::type * = 0)
+    {
+        int64_t rightArgument = right;
+
+        if (rightArgument == 0)
+            return out.fail(arith::DivisionByZero);
+
+        int64_t remainder = rightArgument == -1 ? 0 : argValue % rightArgument;
+
+        out.template quotient<T>(remainder);
+    }
+
+    template <typename T, typename Out>
+    static void             apply(T argValue, long double right, Out & out,
+                                  typename std::enable_if<std::is_floating_point<T>::value>::type * = 0)
+    {
+        T   rightArgument = right;
+
+        if (rightArgument == 0)
+            return out.fail(arith::DivisionByZero);
+        T   remainder = fmod(argValue, rightArgument);
+
+        out.template value<T>(remainder);
+    }
+};
+
+}
+
+#endif
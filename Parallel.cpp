@@ -0,0 +1,216 @@
+#include "Parallel.hpp"
+#include "Lexer.hpp"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+Dataflow::Dataflow(program_t const & program) : program_(program), depth_(0)
+{
+    std::vector<int>    stack;
+
+    for (size_t pc = 0; pc < program_.size(); pc++)
+    {
+        instruction_t const *instr = program_[pc].get();
+        node_t              node = { pc, -1, -1, 1, 0, false };
+        size_t              moved = instr->opcode == OpDup ? 1 : instr->opcode == OpRot ? 3 : 2;
+
+        if (instr->opcode == OpExit || (instr->opcode == OpPop && stack.size() < instr->count)
+            || (instr->opcode == OpPrint && stack.empty()))
+            break ;
+        if (instr->opcode == OpPop)
+            stack.resize(stack.size() - instr->count);
+        if (instr->opcode >= OpDup && instr->opcode <= OpRot && stack.size() < moved)
+            break ;
+        // Stack ops run as they are in the replay: a copy is the same value
+        // as its source, so the graph becomes a DAG
+        if (instr->opcode == OpDup || instr->opcode == OpOver)
+            stack.push_back(stack[stack.size() - moved]);
+        else if (instr->opcode == OpSwap || instr->opcode == OpRot)
+            std::rotate(stack.end() - moved, stack.end() - moved + 1, stack.end());
+        else if (instr->opcode == OpClear)
+            stack.clear();
+        if (instr->opcode >= OpAdd && instr->opcode <= OpMod)
+        {
+            if (stack.size() < 2)
+                break ;
+            node.right = stack.back();
+            stack.pop_back();
+            node.left = stack.back();
+            stack.pop_back();
+            node.depth = std::max(nodes_[node.left].depth, nodes_[node.right].depth) + 1;
+        }
+        if (instr->opcode == OpPush || (instr->opcode >= OpAdd && instr->opcode <= OpMod))
+        {
+            stack.push_back(static_cast<int>(nodes_.size()));
+            nodes_.push_back(node);
+            depth_ = std::max(depth_, node.depth);
+        }
+    }
+
+    std::vector<std::atomic<int> >  pending(nodes_.size());
+
+    firstUser_.assign(nodes_.size() + 1, 0);
+    for (node_t const & node : nodes_)
+        if (node.left >= 0)
+        {
+            firstUser_[node.left + 1]++;
+            firstUser_[node.right + 1]++;
+        }
+    for (size_t id = 0; id < nodes_.size(); id++)
+    {
+        firstUser_[id + 1] += firstUser_[id];
+        pending[id] = nodes_[id].left < 0 ? 0 : 2;
+    }
+    users_.resize(firstUser_.back());
+
+    std::vector<size_t> filled(firstUser_.begin(), firstUser_.end() - 1);
+
+    for (size_t id = 0; id < nodes_.size(); id++)
+        if (nodes_[id].left >= 0)
+        {
+            users_[filled[nodes_[id].left]++] = static_cast<int>(id);
+            users_[filled[nodes_[id].right]++] = static_cast<int>(id);
+        }
+    pending_.swap(pending);
+}
+
+Dataflow::~Dataflow()
+{
+    for (node_t & node : nodes_)
+        delete node.result;
+}
+
+bool    Dataflow::worthRunning(size_t threads) const
+{
+    return threads > 1 && nodes_.size() >= 1024 && nodes_.size() / depth_ >= 2 * threads;
+}
+
+void    Dataflow::evaluate(node_t & node) const
+{
+    instruction_t const *instr = program_[node.pc].get();
+
+    if (instr->opcode == OpPush)
+    {
+        node.result = AVM::createOperand(static_cast<eOperandType>(instr->arg->type), instr->arg->content);
+        return ;
+    }
+
+    node_t const    &leftNode = nodes_[node.left];
+    node_t const    &rightNode = nodes_[node.right];
+
+    if (leftNode.failed || rightNode.failed)
+    {
+        node.failed = true;
+        return ;
+    }
+
+    int             precision = std::max(leftNode.result->getPrecision(), rightNode.result->getPrecision());
+    eOperandType    type = static_cast<eOperandType>(precision);
+    IOperand const  *left = leftNode.result->getPrecision() < precision
+                            ? AVM::createOperand(type, leftNode.result->toString()) : leftNode.result;
+    IOperand const  *right = rightNode.result->getPrecision() < precision
+                             ? AVM::createOperand(type, rightNode.result->toString()) : rightNode.result;
+
+    try
+    {
+        switch (instr->opcode)
+        {
+            case OpAdd: node.result = *left + *right; break;
+            case OpSub: node.result = *left - *right; break;
+            case OpMul: node.result = *left * *right; break;
+            case OpDiv: node.result = *left / *right; break;
+            default:    node.result = *left % *right; break;
+        }
+    }
+    catch (std::exception const &)
+    {
+        node.failed = true;
+    }
+    if (left != leftNode.result)
+        delete left;
+    if (right != rightNode.result)
+        delete right;
+}
+
+struct  worker_t
+{
+    std::mutex      lock;
+    std::deque<int> tasks;
+};
+
+void    Dataflow::run(size_t threads)
+{
+    std::vector<worker_t>   workers(threads);
+    std::atomic<size_t>     remaining(nodes_.size());
+    size_t                  next = 0;
+
+    for (size_t id = 0; id < nodes_.size(); id++)
+        if (nodes_[id].left < 0)
+            workers[next++ % threads].tasks.push_back(static_cast<int>(id));
+
+    auto    work = [&](size_t self)
+    {
+        while (remaining.load() > 0)
+        {
+            int     id = -1;
+
+            {
+                std::lock_guard<std::mutex> guard(workers[self].lock);
+
+                if (!workers[self].tasks.empty())
+                {
+                    id = workers[self].tasks.back();
+                    workers[self].tasks.pop_back();
+                }
+            }
+            for (size_t k = 1; id < 0 && k < threads; k++)
+            {
+                worker_t                    &victim = workers[(self + k) % threads];
+                std::lock_guard<std::mutex> guard(victim.lock);
+
+                if (!victim.tasks.empty())
+                {
+                    id = victim.tasks.front();
+                    victim.tasks.pop_front();
+                }
+            }
+            if (id < 0)
+            {
+                std::this_thread::yield();
+                continue ;
+            }
+            evaluate(nodes_[id]);
+            for (size_t edge = firstUser_[id]; edge < firstUser_[id + 1]; edge++)
+            {
+                int     user = users_[edge];
+
+                if (pending_[user].fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> guard(workers[self].lock);
+
+                    workers[self].tasks.push_back(user);
+                }
+            }
+            remaining--;
+        }
+    };
+
+    std::vector<std::thread>    pool;
+
+    for (size_t self = 1; self < threads; self++)
+        pool.emplace_back(work, self);
+    work(0);
+    for (std::thread & thread : pool)
+        thread.join();
+}
+
+void    Dataflow::results(std::vector<IOperand const *> & precomputed)
+{
+    precomputed.assign(program_.size(), 0);
+    for (node_t & node : nodes_)
+    {
+        precomputed[node.pc] = node.result;
+        node.result = 0;
+    }
+}
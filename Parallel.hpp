@@ -0,0 +1,50 @@
+#ifndef PARALLEL_HPP
+# define PARALLEL_HPP
+
+#include "AVM.hpp"
+#include <atomic>
+#include <vector>
+
+// Dependency graph of the values a program computes. Every push and every
+// arithmetic instruction is a node whose inputs are the two slots it pops;
+// dup and over copy a slot, so a node may have several users. Nodes are
+// evaluated by a work-stealing pool, then AVM::run replays the program in
+// order, taking each precomputed operand instead of executing the
+// instruction, so output and the first error stay those of a sequential run.
+
+class Dataflow
+{
+
+    struct  node_t
+    {
+        size_t              pc;
+        int                 left;
+        int                 right;
+        size_t              depth;
+        IOperand const      *result;
+        bool                failed;
+    };
+
+    program_t const                 &program_;
+    std::vector<node_t>             nodes_;
+    std::vector<size_t>             firstUser_; // users of node i are users_[firstUser_[i]..firstUser_[i + 1]]
+    std::vector<int>                users_;
+    std::vector<std::atomic<int> >  pending_;
+    size_t                          depth_;
+
+    void    evaluate(node_t & node) const;
+
+public:
+
+    explicit Dataflow(program_t const & program);
+    Dataflow(Dataflow const &) = delete;
+    Dataflow & operator = (Dataflow const &) = delete;
+    ~Dataflow();
+
+    bool    worthRunning(size_t threads) const;
+    void    run         (size_t threads);
+    void    results     (std::vector<IOperand const *> & precomputed);
+
+};
+
+#endif
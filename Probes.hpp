@@ -0,0 +1,37 @@
+#ifndef PROBES_HPP
+# define PROBES_HPP
+
+// Static tracepoints of the "avm" provider. With <sys/sdt.h> available each
+// probe is a single nop plus an ELF note that perf, bpftrace and SystemTap
+// find by name; arguments are only read once a tracer is attached. Without
+// the header, or when built with -DAVM_NO_PROBES, the probes vanish.
+//
+//  lex_start   ()                              the source is about to be read
+//  lex_done    (instructions, failed)          the program is loaded
+//  lex_error   (line)                          a line was rejected
+//  phase       (name)                          a pipeline phase begins
+//  dispatch    (pc, opcode, line, name)        an instruction is about to run
+//  error       (pc, opcode, line)              an instruction stopped the machine
+
+#if !defined(AVM_NO_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define AVM_PROBES
+# endif
+#endif
+
+#ifdef AVM_PROBES
+# define AVM_PROBE0(name)                   DTRACE_PROBE(avm, name)
+# define AVM_PROBE1(name, a)                DTRACE_PROBE1(avm, name, a)
+# define AVM_PROBE2(name, a, b)             DTRACE_PROBE2(avm, name, a, b)
+# define AVM_PROBE3(name, a, b, c)          DTRACE_PROBE3(avm, name, a, b, c)
+# define AVM_PROBE4(name, a, b, c, d)       DTRACE_PROBE4(avm, name, a, b, c, d)
+#else
+# define AVM_PROBE0(name)                   do {} while (0)
+# define AVM_PROBE1(name, a)                do {} while (0)
+# define AVM_PROBE2(name, a, b)             do {} while (0)
+# define AVM_PROBE3(name, a, b, c)          do {} while (0)
+# define AVM_PROBE4(name, a, b, c, d)       do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include "Profile.hpp"
+#include "Lexer.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sys/time.h>
+
+volatile sig_atomic_t   Profiler::sampleRequested = 0;
+
+static void requestSample(int)
+{
+    Profiler::sampleRequested = 1;
+}
+
+Profiler::Profiler(program_t const & program, std::string const & root, unsigned rate)
+    : program_(program), samples_(program.size()), parent_(program.size()), root_(root), rate_(rate ? rate : 1)
+{
+    std::vector<size_t>     blocks;
+
+    for (size_t pc = 0; pc < program.size(); pc++)
+    {
+        parent_[pc] = blocks.empty() ? SIZE_MAX : blocks.back();
+        if (program[pc]->opcode == OpRepeat)
+            blocks.push_back(pc);
+        else if (program[pc]->opcode == OpEnd && !blocks.empty())
+            blocks.pop_back();
+    }
+}
+
+void        Profiler::start()
+{
+    struct itimerval    timer;
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = std::max(1000000 / rate_, 1u);
+    timer.it_value = timer.it_interval;
+    sampleRequested = 0;
+    std::signal(SIGPROF, requestSample);
+    setitimer(ITIMER_PROF, &timer, 0);
+}
+
+void        Profiler::stop()
+{
+    struct itimerval    timer = {};
+
+    setitimer(ITIMER_PROF, &timer, 0);
+    std::signal(SIGPROF, SIG_DFL);
+    sampleRequested = 0;
+}
+
+std::string Profiler::frame(size_t pc) const
+{
+    instruction_t const     *instr = program_[pc].get();
+
+    return std::string(instr->name) + ":" + std::to_string(instr->line);
+}
+
+void        Profiler::write(std::string const & path) const
+{
+    std::ofstream                       stacks(path);
+    std::ofstream                       lines(path + ".lines");
+    std::map<size_t, uint64_t>          perLine;
+    std::map<size_t, size_t>            linePc;
+    uint64_t                            total = 0;
+
+    for (size_t pc = 0; pc < samples_.size(); pc++)
+    {
+        if (!samples_[pc])
+            continue ;
+
+        std::string     stack = frame(pc);
+
+        for (size_t block = parent_[pc]; block != SIZE_MAX; block = parent_[block])
+            stack = frame(block) + ";" + stack;
+        stacks << root_ << ";" << stack << " " << samples_[pc] << "\n";
+        perLine[program_[pc]->line] += samples_[pc];
+        linePc.insert(std::make_pair(program_[pc]->line, pc));
+        total += samples_[pc];
+    }
+
+    std::vector<std::pair<uint64_t, size_t> >   hot;
+
+    for (auto const & line : perLine)
+        hot.push_back(std::make_pair(line.second, line.first));
+    std::sort(hot.begin(), hot.end(), [](std::pair<uint64_t, size_t> const & a, std::pair<uint64_t, size_t> const & b)
+              { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+    lines << "samples  percent      line  instruction   (" << total << " samples at " << rate_ << " Hz)\n";
+    for (auto const & line : hot)
+    {
+        instruction_t const     *instr = program_[linePc[line.second]].get();
+
+        lines << std::setw(7) << line.first << "  " << std::setw(6) << std::fixed << std::setprecision(2)
+              << 100.0 * line.first / total << "%  " << std::setw(8) << line.second << "  " << instr->name;
+        if (instr->arg)
+            lines << " " << Lexer::argTypes[instr->arg->type] << "(" << instr->arg->content << ")";
+        if (instr->opcode == OpRepeat || instr->count != 1)
+            lines << " " << instr->count;
+        lines << "\n";
+    }
+    if (!stacks.flush() || !lines.flush())
+        throw WriteErrorException();
+}
+
+const char *Profiler::WriteErrorException::what() const throw() {
+    return "unable to write profile!";
+}
@@ -0,0 +1,48 @@
+#ifndef PROFILE_HPP
+# define PROFILE_HPP
+
+#include "AVM.hpp"
+#include <string>
+#include <vector>
+
+// Sampling profiler. A SIGPROF timer only raises a flag; the VM answers it
+// after the instruction that was running and the sample goes to that
+// instruction's pc. write() gives collapsed stacks (the enclosing repeat
+// blocks, then the instruction, each as name:line) for flamegraph tools,
+// and a per-source-line listing of the hottest lines in path.lines.
+
+class Profiler
+{
+
+    program_t const             &program_;
+    std::vector<uint64_t>       samples_;
+    std::vector<size_t>         parent_;    // enclosing repeat, SIZE_MAX at top level
+    std::string                 root_;
+    unsigned                    rate_;
+
+    std::string     frame   (size_t pc) const;
+
+public:
+
+    struct WriteErrorException : std::exception
+    {
+        WriteErrorException() = default;
+        ~WriteErrorException() throw() = default;
+        WriteErrorException&operator=(WriteErrorException&) = delete;
+        const char * what() const throw();
+    };
+
+    Profiler(program_t const & program, std::string const & root, unsigned rate);
+    Profiler(Profiler const &) = delete;
+    Profiler & operator = (Profiler const &) = delete;
+
+    void        start   (void);
+    void        stop    (void);
+    void        sample  (size_t pc) { samples_[pc]++; }
+    void        write   (std::string const & path) const;
+
+    static volatile sig_atomic_t    sampleRequested;
+
+};
+
+#endif
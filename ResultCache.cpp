@@ -0,0 +1,309 @@
+#include "ResultCache.hpp"
+#include "Lexer.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <vector>
+
+static const char   resultMagic[8] = { 'A', 'V', 'M', 'R', 'E', 'S', 'U', '2' };
+static const char   entrySuffix[] = ".avmr";
+
+static const uint32_t   roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t  rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+// FIPS 180-4 SHA-256, as lowercase hex
+static std::string  sha256(std::string message)
+{
+    uint32_t    h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    uint64_t    bits = static_cast<uint64_t>(message.size()) * 8;
+
+    message += static_cast<char>(0x80);
+    while (message.size() % 64 != 56)
+        message += '\0';
+    for (int shift = 56; shift >= 0; shift -= 8)
+        message += static_cast<char>(bits >> shift);
+
+    for (size_t block = 0; block < message.size(); block += 64)
+    {
+        unsigned char const     *data = reinterpret_cast<unsigned char const *>(message.data() + block);
+        uint32_t                w[64];
+        uint32_t                v[8];
+
+        for (int i = 0; i < 16; i++)
+            w[i] = static_cast<uint32_t>(data[4 * i]) << 24 | data[4 * i + 1] << 16 | data[4 * i + 2] << 8 | data[4 * i + 3];
+        for (int i = 16; i < 64; i++)
+            w[i] = w[i - 16] + (rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3))
+                   + w[i - 7] + (rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10));
+        std::copy(h, h + 8, v);
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t    t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25))
+                             + ((v[4] & v[5]) ^ (~v[4] & v[6])) + roundConstants[i] + w[i];
+            uint32_t    t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22))
+                             + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+            std::copy_backward(v, v + 7, v + 8);
+            v[4] += t1;
+            v[0] = t1 + t2;
+        }
+        for (int i = 0; i < 8; i++)
+            h[i] += v[i];
+    }
+
+    char    hex[65];
+
+    for (int i = 0; i < 8; i++)
+        std::snprintf(hex + 8 * i, 9, "%08x", h[i]);
+    return std::string(hex, 64);
+}
+
+static void         appendString(std::string & buffer, std::string const & text)
+{
+    uint64_t    size = text.size();
+
+    buffer.append(reinterpret_cast<char const *>(&size), sizeof(size));
+    buffer += text;
+}
+
+static bool         readString(char const *& it, char const * end, std::string & text)
+{
+    uint64_t    size;
+
+    if (static_cast<size_t>(end - it) < sizeof(size))
+        return false;
+    std::memcpy(&size, it, sizeof(size));
+    it += sizeof(size);
+    if (static_cast<uint64_t>(end - it) < size)
+        return false;
+    text.assign(it, size);
+    it += size;
+    return true;
+}
+
+// Writes through a temporary so readers see the old file or the new one
+static bool         writeAtomically(std::string const & path, std::string const & data)
+{
+    std::string tmpPath = path + ".tmp" + std::to_string(getpid());
+    FILE        *file = std::fopen(tmpPath.c_str(), "wb");
+
+    if (!file)
+        return false;
+    bool    written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+
+    if (std::fclose(file) != 0 || !written || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+ResultCache::ResultCache(std::string const & dir, uint64_t maxBytes)
+    : dir_(dir), maxBytes_(maxBytes)
+{
+    mkdir(dir_.c_str(), 0777);
+}
+
+std::string     ResultCache::key(program_t const & program, limits_t const & limits)
+{
+    std::ostringstream  text;
+
+    text << "limits " << limits.maxInstructions << " " << limits.maxStack << "\n";
+    for (std::unique_ptr<instruction_t> const & instr : program)
+    {
+        text << instr->name;
+        if (instr->arg)
+            text << " " << instr->arg->type << "(" << instr->arg->content << ")";
+        if (instr->opcode >= OpRepeat || instr->count != 1)
+            text << " " << instr->count << " " << instr->target;
+        text << "\n";
+    }
+    return sha256(text.str());
+}
+
+std::string     ResultCache::entryPath(std::string const & key) const
+{
+    return dir_ + "/" + key + entrySuffix;
+}
+
+// DIR/stats holds "hits N\nmisses M\n"
+static void     readCounts(int fd, uint64_t & hits, uint64_t & misses)
+{
+    char    text[64];
+    ssize_t size = pread(fd, text, sizeof(text) - 1, 0);
+
+    hits = misses = 0;
+    if (size <= 0)
+        return ;
+    text[size] = '\0';
+    std::sscanf(text, "hits %" SCNu64 " misses %" SCNu64, &hits, &misses);
+}
+
+static bool     writeCounts(int fd, uint64_t hits, uint64_t misses)
+{
+    std::string text = "hits " + std::to_string(hits) + "\nmisses " + std::to_string(misses) + "\n";
+
+    return ftruncate(fd, 0) == 0 && pwrite(fd, text.data(), text.size(), 0) == static_cast<ssize_t>(text.size());
+}
+
+// Rewritten in place under an exclusive lock, so runs that finish together
+// never lose each other's counts. A count that cannot be kept costs nothing.
+void            ResultCache::count(bool hit) const
+{
+    int         fd = open((dir_ + "/stats").c_str(), O_RDWR | O_CREAT, 0666);
+    uint64_t    hits, misses;
+
+    if (fd < 0)
+        return ;
+    if (flock(fd, LOCK_EX) == 0)
+    {
+        readCounts(fd, hits, misses);
+        (hit ? hits : misses)++;
+        writeCounts(fd, hits, misses);
+    }
+    close(fd);
+}
+
+bool            ResultCache::replay(std::string const & key, std::ostream & out, std::ostream & err, int & status)
+{
+    std::string     path = entryPath(key);
+    std::ifstream   file(path, std::ios::binary);
+    std::string     data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    char const      *it = data.data();
+    char const      *end = it + data.size();
+    int32_t         stored;
+    std::string     output;
+
+    if (data.size() < sizeof(resultMagic) + sizeof(stored)
+        || std::memcmp(it, resultMagic, sizeof(resultMagic)) != 0)
+    {
+        count(false);
+        return false;
+    }
+    it += sizeof(resultMagic);
+    std::memcpy(&stored, it, sizeof(stored));
+    it += sizeof(stored);
+    if (!readString(it, end, output) || !Transcript::valid(output))
+    {
+        count(false);
+        return false;
+    }
+    utime(path.c_str(), 0);
+    count(true);
+    Transcript::replay(output, out, err);
+    status = stored;
+    return true;
+}
+
+// The copy stops at maxBytes: a larger run could never be kept anyway
+void            ResultCache::record(AVM & vm)
+{
+    transcript_.setLimit(maxBytes_);
+    transcript_.attach(vm);
+}
+
+void            ResultCache::store(std::string const & key, int status)
+{
+    std::string     buffer(resultMagic, sizeof(resultMagic));
+    int32_t         stored = status;
+
+    if (transcript_.truncated())
+        return ;
+    buffer.append(reinterpret_cast<char const *>(&stored), sizeof(stored));
+    appendString(buffer, transcript_.data());
+    // A failed write only costs the next run a miss
+    if (buffer.size() <= maxBytes_ && writeAtomically(entryPath(key), buffer))
+        evict();
+}
+
+struct  entry_t
+{
+    struct timespec     used;
+    off_t               size;
+    std::string         path;
+};
+
+static void     listEntries(std::string const & dir, std::vector<entry_t> & entries)
+{
+    DIR             *handle = opendir(dir.c_str());
+    size_t const    suffix = sizeof(entrySuffix) - 1;
+
+    if (!handle)
+        return ;
+    while (struct dirent * found = readdir(handle))
+    {
+        std::string     name = found->d_name;
+        struct stat     info;
+
+        if (name.size() <= suffix || name.compare(name.size() - suffix, suffix, entrySuffix))
+            continue ;
+        name = dir + "/" + name;
+        if (stat(name.c_str(), &info) == 0)
+            entries.push_back(entry_t{ info.st_mtim, info.st_size, name });
+    }
+    closedir(handle);
+}
+
+void            ResultCache::evict(void) const
+{
+    std::vector<entry_t>    entries;
+    uint64_t                total = 0;
+
+    listEntries(dir_, entries);
+    for (entry_t const & entry : entries)
+        total += entry.size;
+    if (total <= maxBytes_)
+        return ;
+    std::sort(entries.begin(), entries.end(), [](entry_t const & a, entry_t const & b)
+    {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > maxBytes_; i++)
+        if (std::remove(entries[i].path.c_str()) == 0)
+            total -= entries[i].size;
+}
+
+void            ResultCache::writeStats(std::ostream & out) const
+{
+    int                     fd = open((dir_ + "/stats").c_str(), O_RDONLY);
+    std::vector<entry_t>    entries;
+    uint64_t                hits = 0;
+    uint64_t                misses = 0;
+    uint64_t                total = 0;
+
+    if (fd >= 0)
+    {
+        if (flock(fd, LOCK_SH) == 0)
+            readCounts(fd, hits, misses);
+        close(fd);
+    }
+    listEntries(dir_, entries);
+    for (entry_t const & entry : entries)
+        total += entry.size;
+    out << "result cache: " << hits << " hits, " << misses << " misses, "
+        << entries.size() << " entries, " << total << " bytes" << std::endl;
+}
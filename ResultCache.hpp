@@ -0,0 +1,45 @@
+#ifndef RESULTCACHE_HPP
+# define RESULTCACHE_HPP
+
+#include "AVM.hpp"
+#include "Transcript.hpp"
+#include <ostream>
+#include <string>
+
+// Output of whole runs, keyed by the SHA-256 of the lexed program. A program
+// reads no input, so the instructions (without comments, blank lines or
+// label names) and the limits that can stop it decide everything it prints.
+// The output is recorded as a Transcript, so a hit replays both streams in
+// the order the run wrote them; a run that prints more than maxBytes is not
+// kept. Entries are files in the cache directory written through a temporary
+// and a rename; a hit touches its file, and the least recently used entries
+// are removed once the directory holds more than maxBytes. Hit and miss
+// counts are kept in the directory as well, updated under a lock, for --stats.
+
+class ResultCache
+{
+
+    std::string         dir_;
+    uint64_t            maxBytes_;
+    Transcript          transcript_;
+
+    std::string         entryPath   (std::string const & key) const;
+    void                count       (bool hit) const;
+    void                evict       (void) const;
+
+public:
+
+    ResultCache(std::string const & dir, uint64_t maxBytes);
+    ResultCache(ResultCache const &) = delete;
+    ResultCache & operator = (ResultCache const &) = delete;
+
+    static std::string  key     (program_t const & program, limits_t const & limits);
+
+    bool    replay      (std::string const & key, std::ostream & out, std::ostream & err, int & status);
+    void    record      (AVM & vm);
+    void    store       (std::string const & key, int status);
+    void    writeStats  (std::ostream & out) const;
+
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef RUNTIME_HPP
+# define RUNTIME_HPP
+
+#include "IOperand.hpp"
+#include "Ops.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Runtime of the programs avm --aot compiles: the operand stack as unboxed
+// slots and the instructions the generated code calls. Every instruction
+// prints what the interpreter prints, and returns false once the machine
+// has stopped.
+
+namespace aot
+{
+
+class machine
+{
+
+    std::vector<ops::slot_t>    stack_;
+
+    bool    fail(std::string const & message)
+    {
+        std::cerr << message << std::endl;
+        exit();
+        return false;
+    }
+
+    template <typename Op, typename L>
+    bool    arithmeticRight(void)
+    {
+        switch (stack_.back().type)
+        {
+            case Int8:      return arithmetic<Op, L, int8_t>();
+            case Int16:     return arithmetic<Op, L, int16_t>();
+            case Int32:     return arithmetic<Op, L, int32_t>();
+            case Int64:     return arithmetic<Op, L, int64_t>();
+            case Float:     return arithmetic<Op, L, float>();
+            case Double:    return arithmetic<Op, L, double>();
+        }
+        return false;
+    }
+
+    template <typename T>
+    bool    equals(ops::slot_t const & slot, char const * literal) const
+    {
+        std::stringstream   stream(literal);
+        T                   tmp;    stream >> tmp;
+
+        return tmp == static_cast<T>(slot.exact);
+    }
+
+public:
+
+    void    exit(void)
+    {
+        std::cout << "machine stopping " << std::endl;
+    }
+
+    void    push(eOperandType type, char const * literal, uint64_t count = 1)
+    {
+        ops::slot_t     slot;
+
+        slot.type = type;
+        slot.literal = literal;
+        slot.exact = std::strtold(literal, 0);
+        stack_.insert(stack_.end(), count, slot);
+    }
+
+    bool    pop(void)
+    {
+        if (stack_.empty())
+            return fail("the stack is empty !");
+        stack_.pop_back();
+        return true;
+    }
+
+    bool    pop(uint64_t count)
+    {
+        if (stack_.size() < count)
+            return fail("pop failed, not enough arguments !");
+        stack_.resize(stack_.size() - count);
+        return true;
+    }
+
+    bool    dump(void)
+    {
+        static const char   *types[] = { "int8", "int16", "int32", "int64", "float", "double" };
+
+        if (stack_.empty())
+            std::cerr << "runtime error: empty stack" << std::endl;
+        for (auto it = stack_.rbegin(); it != stack_.rend(); ++it)
+            std::cout << types[it->type] << '\t' << ops::text(*it) << std::endl;
+        return true;
+    }
+
+    bool    assertTop(eOperandType type, char const * literal)
+    {
+        bool    equal = false;
+
+        if (stack_.empty())
+        {
+            std::cerr << "runtime error: stack is empty" << std::endl;
+            return true;
+        }
+        switch (stack_.back().type == type ? type : -1)
+        {
+            case Int8:      equal = ops::text(stack_.back()) == literal;        break;
+            case Int16:     equal = equals<int16_t>(stack_.back(), literal);    break;
+            case Int32:     equal = equals<int32_t>(stack_.back(), literal);    break;
+            case Int64:     equal = equals<int64_t>(stack_.back(), literal);    break;
+            case Float:     equal = equals<float>(stack_.back(), literal);      break;
+            case Double:    equal = equals<double>(stack_.back(), literal);     break;
+        }
+        if (!equal)
+            return fail("assert failed !");
+        std::cout << "assert success" << std::endl;
+        return true;
+    }
+
+    bool    print(void)
+    {
+        if (stack_.empty())
+            return fail("runtime error: empty stack");
+        if (stack_.back().type == Int8)
+            std::cout << static_cast<char>(std::atoi(ops::text(stack_.back()).c_str())) << std::endl;
+        else
+            std::cerr << "print_assert failed !" << std::endl;
+        return true;
+    }
+
+    bool    dup(void)
+    {
+        if (stack_.empty())
+            return fail("dup failed, not enough arguments !");
+        stack_.push_back(stack_.back());
+        return true;
+    }
+
+    bool    swap(void)
+    {
+        if (stack_.size() < 2)
+            return fail("swap failed, not enough arguments !");
+        std::swap(stack_[stack_.size() - 1], stack_[stack_.size() - 2]);
+        return true;
+    }
+
+    bool    over(void)
+    {
+        if (stack_.size() < 2)
+            return fail("over failed, not enough arguments !");
+        stack_.push_back(stack_[stack_.size() - 2]);
+        return true;
+    }
+
+    bool    rot(void)
+    {
+        if (stack_.size() < 3)
+            return fail("rot failed, not enough arguments !");
+        std::rotate(stack_.end() - 3, stack_.end() - 2, stack_.end());
+        return true;
+    }
+
+    void    clear(void)
+    {
+        stack_.clear();
+    }
+
+    bool    zero(bool & isZero)
+    {
+        if (stack_.empty())
+            return fail("runtime error: empty stack");
+        isZero = stack_.back().exact == 0;
+        return true;
+    }
+
+    // Operand types known when the program was compiled
+    template <typename Op, typename L, typename R>
+    bool    arithmetic(void)
+    {
+        using T = typename std::conditional<(arith::type_of<L>::value >= arith::type_of<R>::value), L, R>::type;
+
+        if (stack_.size() < 2)
+            return fail(std::string(Op::name()) + " failed, not enough arguments !");
+
+        ops::slot_t const   &right = stack_.back();
+        ops::slot_t const   &left = stack_[stack_.size() - 2];
+        T                   argValue = std::is_same<L, T>::value ? static_cast<T>(static_cast<L>(left.exact))
+                                                                 : static_cast<T>(left.exact);
+        bool const          unboxed = std::is_same<R, T>::value && std::is_floating_point<T>::value && !Op::exactRight;
+        long double         rightArgument = unboxed ? static_cast<R>(right.exact) : right.exact;
+
+        stack_.pop_back();
+
+        ops::unboxed        sink(stack_.back());
+
+        Op::template apply<T>(argValue, rightArgument, sink);
+        if (sink.status == arith::Ok)
+            return true;
+        stack_.pop_back();
+        std::cout << "runtime error instruction " << Op::name() << ": " << arith::message(sink.status) << std::endl;
+        exit();
+        return false;
+    }
+
+    // Operand types found at run time
+    template <typename Op>
+    bool    arithmetic(void)
+    {
+        if (stack_.size() < 2)
+            return fail(std::string(Op::name()) + " failed, not enough arguments !");
+        switch (stack_[stack_.size() - 2].type)
+        {
+            case Int8:      return arithmeticRight<Op, int8_t>();
+            case Int16:     return arithmeticRight<Op, int16_t>();
+            case Int32:     return arithmeticRight<Op, int32_t>();
+            case Int64:     return arithmeticRight<Op, int64_t>();
+            case Float:     return arithmeticRight<Op, float>();
+            case Double:    return arithmeticRight<Op, double>();
+        }
+        return false;
+    }
+
+};
+
+}
+
+#endif
@@ -0,0 +1,24 @@
+#include "Scheduler.hpp"
+
+Scheduler::Scheduler(uint64_t quantum) : quantum_(quantum ? quantum : 1), added_(0) {}
+
+size_t  Scheduler::add(AVM & vm, program_t const & program)
+{
+    ready_.push_back(task_t{ &vm, &program, added_ });
+    return added_++;
+}
+
+void    Scheduler::run(std::function<void(size_t, eRunStatus)> const & turn)
+{
+    while (!ready_.empty())
+    {
+        task_t      task = ready_.front();
+        eRunStatus  status;
+
+        ready_.pop_front();
+        status = task.vm->run(*task.program, quantum_);
+        if (status == Yielded)
+            ready_.push_back(task);
+        turn(task.id, status);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_HPP
+# define SCHEDULER_HPP
+
+#include "AVM.hpp"
+#include <deque>
+#include <functional>
+
+// Round-robin of many VMs on the calling thread. Every turn runs one VM for
+// the same quantum of instructions; a VM that yields goes to the back of the
+// queue with its stack and program counter untouched, any other status ends
+// it. The status of every turn is reported to the callback with the id add()
+// returned.
+
+class Scheduler
+{
+
+    struct  task_t
+    {
+        AVM                 *vm;
+        program_t const     *program;
+        size_t              id;
+    };
+
+    std::deque<task_t>      ready_;
+    uint64_t                quantum_;
+    size_t                  added_;
+
+public:
+
+    explicit Scheduler(uint64_t quantum);
+    Scheduler(Scheduler const &) = delete;
+    Scheduler & operator = (Scheduler const &) = delete;
+
+    size_t  add     (AVM & vm, program_t const & program);
+    size_t  pending (void) const { return ready_.size(); }
+    void    run     (std::function<void(size_t, eRunStatus)> const & turn);
+
+};
+
+#endif
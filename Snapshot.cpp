@@ -0,0 +1,252 @@
+#include "Snapshot.hpp"
+#include "Lexer.hpp"
+#include "Operand.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char   snapshotMagic[8] = { 'A', 'V', 'M', 'S', 'N', 'A', 'P', '2' };
+
+template <typename T>
+static void         appendRaw(std::string & out, T value)
+{
+    out.append(reinterpret_cast<char const *>(&value), sizeof(T));
+}
+
+template <typename T>
+static T            readRaw(char const *& it, char const * end)
+{
+    T   value;
+
+    if (static_cast<size_t>(end - it) < sizeof(T))
+        throw Snapshot::BadSnapshotException();
+    std::memcpy(&value, it, sizeof(T));
+    it += sizeof(T);
+    return value;
+}
+
+template <typename T>
+static void         encodeValue(std::string & out, IOperand const * operand)
+{
+    appendRaw(out, static_cast<Operand<T> const *>(operand)->getValue());
+}
+
+template <typename T>
+static IOperand const *decodeValue(char const *& it, char const * end, int precision)
+{
+    T           value = readRaw<T>(it, end);
+    uint32_t    length = readRaw<uint32_t>(it, end);
+
+    if (static_cast<size_t>(end - it) < length)
+        throw Snapshot::BadSnapshotException();
+    it += length;
+    return new Operand<T>(value, std::string(it - length, length), precision);
+}
+
+uint64_t    Snapshot::hashProgram(program_t const & program)
+{
+    uint64_t    hash = 14695981039346656037ULL;
+
+    auto        mix = [&hash](char const * data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+    };
+
+    for (std::unique_ptr<instruction_t> const & instr : program)
+    {
+        mix(instr->name, std::strlen(instr->name) + 1);
+        if (instr->arg)
+        {
+            char    type = static_cast<char>(instr->arg->type);
+
+            mix(&type, 1);
+            mix(instr->arg->content.c_str(), instr->arg->content.size());
+        }
+        if (instr->opcode >= OpRepeat || instr->count != 1)
+        {
+            mix(reinterpret_cast<char const *>(&instr->count), sizeof(instr->count));
+            mix(reinterpret_cast<char const *>(&instr->target), sizeof(instr->target));
+        }
+        mix("\n", 1);
+    }
+    return hash;
+}
+
+void        Snapshot::encodeOperand(std::string & out, IOperand const * operand)
+{
+    out += static_cast<char>(operand->getPrecision());
+    switch (operand->getType())
+    {
+        case Int8:      encodeValue<int8_t>(out, operand);  break;
+        case Int16:     encodeValue<int16_t>(out, operand); break;
+        case Int32:     encodeValue<int32_t>(out, operand); break;
+        case Int64:     encodeValue<int64_t>(out, operand); break;
+        case Float:     encodeValue<float>(out, operand);   break;
+        case Double:    encodeValue<double>(out, operand);  break;
+    }
+    appendRaw(out, static_cast<uint32_t>(operand->toString().size()));
+    out += operand->toString();
+}
+
+IOperand const *Snapshot::decodeOperand(char const *& it, char const * end)
+{
+    int     precision = readRaw<uint8_t>(it, end);
+
+    switch (precision)
+    {
+        case Int8:      return decodeValue<int8_t>(it, end, precision);
+        case Int16:     return decodeValue<int16_t>(it, end, precision);
+        case Int32:     return decodeValue<int32_t>(it, end, precision);
+        case Int64:     return decodeValue<int64_t>(it, end, precision);
+        case Float:     return decodeValue<float>(it, end, precision);
+        case Double:    return decodeValue<double>(it, end, precision);
+    }
+    throw BadSnapshotException();
+}
+
+void        Snapshot::encodeHeader(std::string & buffer, AVM const & vm, size_t from)
+{
+    buffer.append(snapshotMagic, sizeof(snapshotMagic));
+    appendRaw(buffer, vm.programHash);
+    appendRaw(buffer, static_cast<uint64_t>(vm.pc));
+    appendRaw(buffer, static_cast<uint64_t>(vm.loops.size()));
+    for (uint64_t counter : vm.loops)
+        appendRaw(buffer, counter);
+    appendRaw(buffer, static_cast<uint64_t>(vm.vmStack.size() - from));
+}
+
+void        Snapshot::encode(std::string & buffer, AVM const & vm, size_t from)
+{
+    encodeHeader(buffer, vm, from);
+    vm.vmStack.forEachFromBottom([&buffer](IOperand const * operand) { encodeOperand(buffer, operand); }, from);
+}
+
+// Operands go to the file a page at a time, so saving a spilled stack never
+// holds more of it in memory than the window and one page.
+void        Snapshot::save(std::string const & path, AVM const & vm)
+{
+    static size_t const pageBytes = 1 << 16;
+    std::string         buffer;
+    std::string         tmpPath = path + ".tmp";
+    FILE                *file = std::fopen(tmpPath.c_str(), "wb");
+
+    if (!file)
+        throw WriteErrorException();
+
+    bool    written = true;
+    auto    flush = [&buffer, &written, file]()
+    {
+        written = written && std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+        buffer.clear();
+    };
+
+    try
+    {
+        encodeHeader(buffer, vm, 0);
+        vm.vmStack.forEachFromBottom([&buffer, &flush](IOperand const * operand)
+        {
+            encodeOperand(buffer, operand);
+            if (buffer.size() >= pageBytes)
+                flush();
+        });
+        flush();
+    }
+    catch (...)
+    {
+        std::fclose(file);
+        std::remove(tmpPath.c_str());
+        throw;
+    }
+    if (std::fclose(file) != 0 || !written || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        throw WriteErrorException();
+    }
+}
+
+void        Snapshot::load(std::string const & path, AVM & vm)
+{
+    int         fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(snapshotMagic)))
+    {
+        if (fd >= 0)
+            close(fd);
+        throw BadSnapshotException();
+    }
+
+    size_t      size = static_cast<size_t>(info.st_size);
+    void        *map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+    if (map == MAP_FAILED)
+        throw BadSnapshotException();
+
+    try
+    {
+        decode(static_cast<char const *>(map), static_cast<char const *>(map) + size, vm);
+    }
+    catch (...)
+    {
+        munmap(map, size);
+        throw;
+    }
+    munmap(map, size);
+}
+
+// Operands are pushed as they are decoded, so a spilled stack is restored
+// through the window; a bad snapshot pops whatever it had pushed.
+void        Snapshot::decode(char const * it, char const * end, AVM & vm)
+{
+    size_t                  size = end - it;
+    std::vector<uint64_t>   loops;
+    uint64_t                pc, count;
+    size_t                  base = vm.vmStack.size();
+
+    try
+    {
+        if (size < sizeof(snapshotMagic) || std::memcmp(it, snapshotMagic, sizeof(snapshotMagic)) != 0)
+            throw BadSnapshotException();
+        it += sizeof(snapshotMagic);
+        if (readRaw<uint64_t>(it, end) != vm.programHash)
+            throw ProgramMismatchException();
+
+        pc = readRaw<uint64_t>(it, end);
+        count = readRaw<uint64_t>(it, end);
+        if (count > size)
+            throw BadSnapshotException();
+        while (count--)
+            loops.push_back(readRaw<uint64_t>(it, end));
+        count = readRaw<uint64_t>(it, end);
+
+        if (count > size)
+            throw BadSnapshotException();
+        while (count--)
+            vm.vmStack.push_back(decodeOperand(it, end));
+        if (it != end)
+            throw BadSnapshotException();
+    }
+    catch (...)
+    {
+        vm.popMany(vm.vmStack.size() - base);
+        throw;
+    }
+    vm.loops.swap(loops);
+    vm.pc = pc;
+}
+
+const char *Snapshot::BadSnapshotException::what() const throw() {
+    return "corrupted or unreadable snapshot!";
+}
+
+const char *Snapshot::ProgramMismatchException::what() const throw() {
+    return "snapshot was taken from a different program!";
+}
+
+const char *Snapshot::WriteErrorException::what() const throw() {
+    return "unable to write snapshot!";
+}
@@ -0,0 +1,54 @@
+#ifndef SNAPSHOT_HPP
+# define SNAPSHOT_HPP
+
+#include "AVM.hpp"
+#include <string>
+
+// Binary checkpoint of a running VM: operand stack (type, raw value, text),
+// program counter, open repeat counters and the hash of the program it was taken from. Restoring
+// rebuilds operands from their raw values and never reparses their text.
+// encode can leave out the operands below depth `from`, for a record that
+// only holds what changed since an earlier one; decode pushes onto whatever
+// the stack already holds.
+
+struct Snapshot
+{
+
+    struct BadSnapshotException : std::exception
+    {
+        BadSnapshotException() = default;
+        ~BadSnapshotException() throw() = default;
+        BadSnapshotException&operator=(BadSnapshotException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct ProgramMismatchException : std::exception
+    {
+        ProgramMismatchException() = default;
+        ~ProgramMismatchException() throw() = default;
+        ProgramMismatchException&operator=(ProgramMismatchException&) = delete;
+        const char * what() const throw();
+    };
+
+    struct WriteErrorException : std::exception
+    {
+        WriteErrorException() = default;
+        ~WriteErrorException() throw() = default;
+        WriteErrorException&operator=(WriteErrorException&) = delete;
+        const char * what() const throw();
+    };
+
+    static uint64_t     hashProgram (program_t const & program);
+
+    static void         save        (std::string const & path, AVM const & vm);
+    static void         load        (std::string const & path, AVM & vm);
+    static void         encode      (std::string & buffer, AVM const & vm, size_t from = 0);
+    static void         encodeHeader(std::string & buffer, AVM const & vm, size_t from);
+    static void         decode      (char const * it, char const * end, AVM & vm);
+
+    static void         encodeOperand(std::string & out, IOperand const * operand);
+    static IOperand const *decodeOperand(char const *& it, char const * end);
+
+};
+
+#endif
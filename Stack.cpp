@@ -0,0 +1,165 @@
+#include "Stack.hpp"
+#include "Snapshot.hpp"
+#include "Operand.hpp"
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const size_t minWindow = 4;
+
+OperandStack::OperandStack(size_t window) : window_(0), spilled_(0), low_(0), fd_(-1), end_(0)
+{
+    setWindow(window);
+}
+
+OperandStack::~OperandStack()
+{
+    for (IOperand const * operand : hot_)
+        delete operand;
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void    OperandStack::setWindow(size_t window)
+{
+    window_ = window && window < minWindow ? minWindow : window;
+    while (window_ && hot_.size() > window_)
+        spill();
+}
+
+template <typename T>
+static void appendCopies(std::vector<IOperand const *> & hot, IOperand const * operand, size_t count)
+{
+    Operand<T> const    &proto = *static_cast<Operand<T> const *>(operand);
+
+    while (count--)
+        hot.push_back(new Operand<T>(proto));
+}
+
+void    OperandStack::pushCopies(IOperand const * operand, size_t count)
+{
+    while (count)
+    {
+        size_t  chunk = window_ ? std::min(count, window_ + 1 - std::min(window_, hot_.size())) : count;
+
+        hot_.reserve(hot_.size() + chunk);
+        switch (operand->getType())
+        {
+            case Int8:      appendCopies<int8_t>(hot_, operand, chunk);     break;
+            case Int16:     appendCopies<int16_t>(hot_, operand, chunk);    break;
+            case Int32:     appendCopies<int32_t>(hot_, operand, chunk);    break;
+            case Int64:     appendCopies<int64_t>(hot_, operand, chunk);    break;
+            case Float:     appendCopies<float>(hot_, operand, chunk);      break;
+            case Double:    appendCopies<double>(hot_, operand, chunk);     break;
+        }
+        count -= chunk;
+        if (window_ && hot_.size() > window_)
+        {
+            operand = hot_.back();
+            spill();
+        }
+    }
+}
+
+void    OperandStack::drop(size_t count)
+{
+    while (count)
+    {
+        if (hot_.empty() && count >= pages_.back().count)
+        {
+            count -= pages_.back().count;
+            spilled_ -= pages_.back().count;
+            end_ = pages_.back().offset;
+            pages_.pop_back();
+            continue ;
+        }
+        if (hot_.empty())
+            fill();
+
+        size_t  chunk = std::min(count, hot_.size());
+
+        for (auto it = hot_.end() - chunk; it != hot_.end(); ++it)
+            delete *it;
+        hot_.resize(hot_.size() - chunk);
+        count -= chunk;
+    }
+    low_ = std::min(low_, size());
+    if (hot_.size() < 3 && !pages_.empty())
+        fill();
+}
+
+void    OperandStack::spill()
+{
+    size_t  count = window_ / 2;
+
+    if (fd_ < 0)
+    {
+        char const  *dir = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/avm-stack-XXXXXX";
+
+        fd_ = mkstemp(&path[0]);
+        if (fd_ < 0)
+            throw SpillErrorException();
+        unlink(path.c_str());
+    }
+
+    buffer_.clear();
+    for (size_t i = 0; i < count; i++)
+        Snapshot::encodeOperand(buffer_, hot_[i]);
+
+    size_t  written = 0;
+
+    while (written < buffer_.size())
+    {
+        ssize_t result = pwrite(fd_, buffer_.data() + written, buffer_.size() - written, end_ + written);
+
+        if (result <= 0)
+            throw SpillErrorException();
+        written += result;
+    }
+
+    pages_.push_back(page_t{ end_, buffer_.size(), count });
+    end_ += buffer_.size();
+    spilled_ += count;
+    for (size_t i = 0; i < count; i++)
+        delete hot_[i];
+    hot_.erase(hot_.begin(), hot_.begin() + count);
+}
+
+void    OperandStack::fill()
+{
+    std::vector<IOperand const *>   operands;
+    page_t                          page = pages_.back();
+
+    readPage(page, operands);
+    hot_.insert(hot_.begin(), operands.begin(), operands.end());
+    pages_.pop_back();
+    spilled_ -= page.count;
+    end_ = page.offset;
+}
+
+void    OperandStack::readPage(page_t const & page, std::vector<IOperand const *> & operands) const
+{
+    std::string buffer(page.bytes, '\0');
+    size_t      read = 0;
+
+    while (read < page.bytes)
+    {
+        ssize_t result = pread(fd_, &buffer[read], page.bytes - read, page.offset + read);
+
+        if (result <= 0)
+            throw SpillErrorException();
+        read += result;
+    }
+
+    char const  *it = buffer.data();
+    char const  *end = it + buffer.size();
+
+    operands.reserve(operands.size() + page.count);
+    while (it < end)
+        operands.push_back(Snapshot::decodeOperand(it, end));
+}
+
+const char *OperandStack::SpillErrorException::what() const throw() {
+    return "unable to spill the stack to disk!";
+}
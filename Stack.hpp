@@ -0,0 +1,139 @@
+#ifndef STACK_HPP
+# define STACK_HPP
+
+#include "IOperand.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Operand stack with a bounded in-memory window. When the window is full its
+// deeper half is encoded (like a snapshot record) into a page appended to an
+// unlinked temporary file, and pages are read back, last first, as the stack
+// unwinds. The window always keeps the three top operands while pages
+// remain, so instructions only ever touch memory. A window of 0 never spills.
+// The stack also remembers the lowest depth it was popped or reordered to
+// since resetLowWater, below which its operands are the same as then.
+
+class OperandStack
+{
+
+    struct  page_t
+    {
+        off_t       offset;
+        size_t      bytes;
+        size_t      count;
+    };
+
+    std::vector<IOperand const *>   hot_;
+    std::vector<page_t>             pages_;
+    size_t                          window_;
+    size_t                          spilled_;
+    size_t                          low_;
+    int                             fd_;
+    off_t                           end_;
+    std::string                     buffer_;
+
+    void    spill   (void);
+    void    fill    (void);
+    void    readPage(page_t const & page, std::vector<IOperand const *> & operands) const;
+
+public:
+
+    struct SpillErrorException : std::exception
+    {
+        SpillErrorException() = default;
+        ~SpillErrorException() throw() = default;
+        SpillErrorException&operator=(SpillErrorException&) = delete;
+        const char * what() const throw();
+    };
+
+    explicit OperandStack(size_t window = 0);
+    OperandStack(OperandStack const &) = delete;
+    OperandStack & operator = (OperandStack const &) = delete;
+    ~OperandStack();
+
+    void            setWindow   (size_t window);
+
+    size_t          size        (void) const { return spilled_ + hot_.size(); }
+    bool            empty       (void) const { return hot_.empty(); }
+    size_t          lowWater    (void) const { return low_; }
+    void            resetLowWater(void) { low_ = size(); }
+    IOperand const  *back       (void) const { return hot_.back(); }
+    IOperand const  *peek       (size_t depth) const { return hot_[hot_.size() - 1 - depth]; }
+
+    void            push_back   (IOperand const * operand)
+    {
+        hot_.push_back(operand);
+        if (window_ && hot_.size() > window_)
+            spill();
+    }
+
+    void            pop_back    (void)
+    {
+        hot_.pop_back();
+        low_ = std::min(low_, size());
+        if (hot_.size() < 3 && !pages_.empty())
+            fill();
+    }
+
+    void            pushCopies  (IOperand const * operand, size_t count);
+    void            drop        (size_t count);
+
+    // Moves the operand at depth - 1 to the top: 2 swaps, 3 rotates.
+    void            rotate      (size_t depth)
+    {
+        std::rotate(hot_.end() - depth, hot_.end() - depth + 1, hot_.end());
+        low_ = std::min(low_, size() - depth);
+    }
+
+    template <typename F>
+    void            forEachFromTop(F visit) const
+    {
+        std::vector<IOperand const *>   operands;
+
+        for (auto it = hot_.rbegin(); it != hot_.rend(); ++it)
+            visit(*it);
+        for (auto page = pages_.rbegin(); page != pages_.rend(); ++page)
+        {
+            readPage(*page, operands);
+            for (auto it = operands.rbegin(); it != operands.rend(); ++it)
+            {
+                visit(*it);
+                delete *it;
+            }
+            operands.clear();
+        }
+    }
+
+    // Visits the operands at depth `from` (counted from the bottom) and up
+    template <typename F>
+    void            forEachFromBottom(F visit, size_t from = 0) const
+    {
+        std::vector<IOperand const *>   operands;
+        size_t                          depth = 0;
+
+        for (page_t const & page : pages_)
+        {
+            if (depth + page.count <= from)
+            {
+                depth += page.count;
+                continue ;
+            }
+            readPage(page, operands);
+            for (IOperand const * operand : operands)
+            {
+                if (depth++ >= from)
+                    visit(operand);
+                delete operand;
+            }
+            operands.clear();
+        }
+        for (IOperand const * operand : hot_)
+            if (depth++ >= from)
+                visit(operand);
+    }
+
+};
+
+#endif
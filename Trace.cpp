@@ -0,0 +1,130 @@
+#include "Trace.hpp"
+#include "Lexer.hpp"
+#include "Operand.hpp"
+#include <cstdio>
+
+static const char   traceMagic[8] = { 'A', 'V', 'M', 'T', 'R', 'A', 'C', 'E' };
+static const uint8_t noOperand = 0xff;
+
+volatile sig_atomic_t   Tracer::dumpRequested = 0;
+
+Tracer::Tracer(std::string const & path, size_t capacity) : mask_(1), head_(0), path_(path)
+{
+    while (mask_ < capacity)
+        mask_ <<= 1;
+    ring_.resize(mask_);
+    mask_--;
+}
+
+void    Tracer::before(size_t pc, instruction_t const * instr, OperandStack const & stack)
+{
+    trace_entry_t   &entry = ring_[head_.load(std::memory_order_relaxed) & mask_];
+    size_t          depth = stack.size();
+
+    entry.pc = static_cast<uint32_t>(pc);
+    entry.line = static_cast<uint32_t>(instr->line);
+    entry.opcode = static_cast<uint8_t>(instr->opcode);
+    entry.depth = static_cast<uint32_t>(depth);
+    entry.rhsType = depth > 0 ? static_cast<uint8_t>(stack.peek(0)->getType()) : noOperand;
+    entry.rhs = depth > 0 ? operandBits(stack.peek(0)) : 0;
+    entry.lhsType = depth > 1 ? static_cast<uint8_t>(stack.peek(1)->getType()) : noOperand;
+    entry.lhs = depth > 1 ? operandBits(stack.peek(1)) : 0;
+}
+
+void    Tracer::after(OperandStack const & stack)
+{
+    uint64_t        head = head_.load(std::memory_order_relaxed);
+    trace_entry_t   &entry = ring_[head & mask_];
+
+    entry.resultType = stack.empty() ? noOperand : static_cast<uint8_t>(stack.back()->getType());
+    entry.result = stack.empty() ? 0 : operandBits(stack.back());
+    head_.store(head + 1, std::memory_order_release);
+}
+
+void    Tracer::dump() const
+{
+    uint64_t    head = head_.load(std::memory_order_acquire);
+    uint64_t    count = std::min<uint64_t>(head, ring_.size());
+    uint32_t    entrySize = sizeof(trace_entry_t);
+    FILE        *file = std::fopen(path_.c_str(), "wb");
+
+    if (!file)
+    {
+        std::cerr << "unable to write trace to " << path_ << std::endl;
+        return ;
+    }
+    std::fwrite(traceMagic, 1, sizeof(traceMagic), file);
+    std::fwrite(&entrySize, sizeof(entrySize), 1, file);
+    std::fwrite(&count, sizeof(count), 1, file);
+    for (uint64_t i = head - count; i < head; i++)
+        std::fwrite(&ring_[i & mask_], sizeof(trace_entry_t), 1, file);
+    std::fclose(file);
+}
+
+template <typename T>
+static std::string  decodeBits(uint64_t bits)
+{
+    T   value;
+
+    std::memcpy(&value, &bits, sizeof(T));
+    return std::to_string(value);
+}
+
+static std::string  decodeOperand(uint8_t type, uint64_t bits)
+{
+    static const char* types[] = {"int8", "int16", "int32", "int64", "float", "double"};
+
+    switch (type)
+    {
+        case Int8:      return std::string(types[type]) + ' ' + decodeBits<int8_t>(bits);
+        case Int16:     return std::string(types[type]) + ' ' + decodeBits<int16_t>(bits);
+        case Int32:     return std::string(types[type]) + ' ' + decodeBits<int32_t>(bits);
+        case Int64:     return std::string(types[type]) + ' ' + decodeBits<int64_t>(bits);
+        case Float:     return std::string(types[type]) + ' ' + decodeBits<float>(bits);
+        case Double:    return std::string(types[type]) + ' ' + decodeBits<double>(bits);
+    }
+    return "-";
+}
+
+void    Tracer::decode(std::string const & tracePath, char const * sourcePath, std::ostream & out)
+{
+    std::ifstream               file(tracePath, std::ios::binary);
+    std::vector<std::string>    source;
+    char                        magic[sizeof(traceMagic)];
+    uint32_t                    entrySize = 0;
+    uint64_t                    count = 0;
+
+    if (sourcePath)
+    {
+        std::ifstream   sourceFile(sourcePath);
+        std::string     line;
+
+        while (std::getline(sourceFile, line))
+            source.push_back(line);
+    }
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&entrySize), sizeof(entrySize));
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!file || std::memcmp(magic, traceMagic, sizeof(magic)) || entrySize != sizeof(trace_entry_t))
+        throw BadTraceException();
+
+    trace_entry_t   entry;
+
+    while (count-- && file.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+    {
+        out << "pc " << entry.pc << "\tline " << entry.line << '\t' << Lexer::instrName(entry.opcode)
+            << "\tdepth " << entry.depth
+            << "\tlhs " << decodeOperand(entry.lhsType, entry.lhs)
+            << "\trhs " << decodeOperand(entry.rhsType, entry.rhs)
+            << "\ttop " << decodeOperand(entry.resultType, entry.result);
+        if (entry.line && entry.line <= source.size())
+            out << "\t| " << source[entry.line - 1];
+        out << std::endl;
+    }
+    if (!file)
+        throw BadTraceException();
+}
+
+const char *Tracer::BadTraceException::what() const throw() {
+    return "corrupted or unreadable trace file!";
+}
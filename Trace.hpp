@@ -0,0 +1,59 @@
+#ifndef TRACE_HPP
+# define TRACE_HPP
+
+#include "AVM.hpp"
+#include <atomic>
+#include <ostream>
+#include <string>
+
+// Fixed-size ring of the last executed instructions with the raw values of
+// their two top operands before and the top of stack after the instruction.
+// Only the VM thread writes, so publishing an entry is a single store.
+
+struct  trace_entry_t
+{
+    uint32_t    pc;
+    uint32_t    line;
+    uint8_t     opcode;
+    uint8_t     lhsType;
+    uint8_t     rhsType;
+    uint8_t     resultType;
+    uint32_t    depth;
+    uint64_t    lhs;
+    uint64_t    rhs;
+    uint64_t    result;
+};
+
+class Tracer
+{
+
+    std::vector<trace_entry_t>  ring_;
+    size_t                      mask_;
+    std::atomic<uint64_t>       head_;
+    std::string                 path_;
+
+public:
+
+    struct BadTraceException : std::exception
+    {
+        BadTraceException() = default;
+        ~BadTraceException() throw() = default;
+        BadTraceException&operator=(BadTraceException&) = delete;
+        const char * what() const throw();
+    };
+
+    Tracer(std::string const & path, size_t capacity);
+    Tracer(Tracer const &) = delete;
+    Tracer & operator = (Tracer const &) = delete;
+
+    void        before  (size_t pc, instruction_t const * instr, OperandStack const & stack);
+    void        after   (OperandStack const & stack);
+    void        dump    (void) const;
+
+    static void decode  (std::string const & tracePath, char const * sourcePath, std::ostream & out);
+
+    static volatile sig_atomic_t    dumpRequested;
+
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "Transcript.hpp"
+#include <cstring>
+
+static const char   outStream = 'o';
+static const char   errStream = 'e';
+
+int             Transcript::tee_t::overflow(int c)
+{
+    char    byte = static_cast<char>(c);
+
+    if (c == EOF)
+        return 0;
+    transcript_.append(stream_, &byte, 1);
+    return target_ ? target_->sputc(byte) : c;
+}
+
+std::streamsize Transcript::tee_t::xsputn(char const * data, std::streamsize size)
+{
+    transcript_.append(stream_, data, size);
+    return target_ ? target_->sputn(data, size) : size;
+}
+
+int             Transcript::tee_t::sync(void)
+{
+    return target_ ? target_->pubsync() : 0;
+}
+
+Transcript::Transcript()
+    : last_(std::string::npos), limit_(UINT64_MAX), truncated_(false), outTee_(*this, outStream),
+      errTee_(*this, errStream), out_(&outTee_), err_(&errTee_), shownOut_(0), shownErr_(0) {}
+
+void            Transcript::append(char stream, char const * text, size_t size)
+{
+    uint64_t    length = 0;
+
+    if (truncated_)
+        return ;
+    if (data_.size() + 1 + sizeof(length) + size > limit_)
+    {
+        std::string().swap(data_);
+        last_ = std::string::npos;
+        truncated_ = true;
+        return ;
+    }
+    if (last_ != std::string::npos && data_[last_] == stream)
+        std::memcpy(&length, &data_[last_ + 1], sizeof(length));
+    else
+    {
+        last_ = data_.size();
+        data_ += stream;
+        data_.append(sizeof(length), '\0');
+    }
+    length += size;
+    std::memcpy(&data_[last_ + 1], &length, sizeof(length));
+    data_.append(text, size);
+}
+
+void            Transcript::attach(AVM & vm)
+{
+    shownOut_ = vm.out;
+    shownErr_ = vm.err;
+    outTee_.setTarget(shownOut_->rdbuf());
+    errTee_.setTarget(shownErr_->rdbuf());
+    out_.copyfmt(*shownOut_);
+    err_.copyfmt(*shownErr_);
+    // Like std::cerr, errors flush the output written before them
+    out_.tie(0);
+    err_.tie(&out_);
+    vm.out = &out_;
+    vm.err = &err_;
+}
+
+void            Transcript::capture(AVM & vm)
+{
+    attach(vm);
+    outTee_.setTarget(0);
+    errTee_.setTarget(0);
+}
+
+void            Transcript::detach(AVM & vm)
+{
+    out_.flush();
+    err_.flush();
+    vm.out = shownOut_;
+    vm.err = shownErr_;
+}
+
+void            Transcript::clear(void)
+{
+    data_.clear();
+    last_ = std::string::npos;
+    truncated_ = false;
+}
+
+bool            Transcript::valid(std::string const & data)
+{
+    char const  *it = data.data();
+    char const  *end = it + data.size();
+    uint64_t    length;
+
+    while (it < end)
+    {
+        if ((*it != outStream && *it != errStream) || static_cast<size_t>(end - it) < 1 + sizeof(length))
+            return false;
+        std::memcpy(&length, it + 1, sizeof(length));
+        it += 1 + sizeof(length);
+        if (static_cast<uint64_t>(end - it) < length)
+            return false;
+        it += length;
+    }
+    return true;
+}
+
+void            Transcript::replay(std::string const & data, std::ostream & out, std::ostream & err)
+{
+    char const  *it = data.data();
+    char const  *end = it + data.size();
+    uint64_t    length;
+
+    while (it < end)
+    {
+        std::ostream    &stream = *it == outStream ? out : err;
+
+        std::memcpy(&length, it + 1, sizeof(length));
+        it += 1 + sizeof(length);
+        stream.write(it, length).flush();
+        it += length;
+    }
+}
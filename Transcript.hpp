@@ -0,0 +1,69 @@
+#ifndef TRANSCRIPT_HPP
+# define TRANSCRIPT_HPP
+
+#include "AVM.hpp"
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+// What a VM writes to its two streams, in the order it wrote it. While
+// attached, the VM writes through tees that pass everything on to the
+// streams it had as it comes and append a copy here, as runs of (stream,
+// size, bytes). Replaying the copy interleaves both streams the same way.
+// A copy that would grow past the limit is dropped and the transcript marked
+// truncated; output still reaches the streams. A capturing transcript keeps
+// the output from the streams until it is replayed.
+
+class Transcript
+{
+
+    // Passes output through to the real stream and records it
+    class   tee_t : public std::streambuf
+    {
+        Transcript          &transcript_;
+        char                stream_;
+        std::streambuf      *target_;
+
+    protected:
+        int                 overflow(int c);
+        std::streamsize     xsputn  (char const * data, std::streamsize size);
+        int                 sync    (void);
+
+    public:
+        tee_t(Transcript & transcript, char stream) : transcript_(transcript), stream_(stream), target_(0) {}
+        void                setTarget(std::streambuf * target) { target_ = target; }
+    };
+
+    std::string         data_;
+    size_t              last_;      // offset of the last run, npos before the first
+    uint64_t            limit_;
+    bool                truncated_;
+    tee_t               outTee_;
+    tee_t               errTee_;
+    std::ostream        out_;
+    std::ostream        err_;
+    std::ostream        *shownOut_;
+    std::ostream        *shownErr_;
+
+    void                append  (char stream, char const * text, size_t size);
+
+public:
+
+    Transcript();
+    Transcript(Transcript const &) = delete;
+    Transcript & operator = (Transcript const &) = delete;
+
+    void                attach  (AVM & vm);
+    void                capture (AVM & vm);
+    void                detach  (AVM & vm);
+    void                clear   (void);
+    void                setLimit(uint64_t limit) { limit_ = limit; }
+    bool                truncated(void) const { return truncated_; }
+    std::string const   &data   (void) const { return data_; }
+
+    static bool         valid   (std::string const & data);
+    static void         replay  (std::string const & data, std::ostream & out, std::ostream & err);
+
+};
+
+#endif
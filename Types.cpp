@@ -0,0 +1,217 @@
+#include "Types.hpp"
+#include "Lexer.hpp"
+
+static const int8_t unknown = -1;
+static const int8_t unset = -2;
+
+// Deepest slot the abstract stack tracks; anything below is unknown.
+static const size_t trackedSlots = 4096;
+
+TypeInference::TypeInference(program_t & program)
+    : program_(program), leader_(program.size() + 1, 0), states_(program.size() + 1),
+      left_(program.size(), unset), right_(program.size(), unset)
+{
+    for (size_t pc = 0; pc < program_.size(); pc++)
+    {
+        instruction_t const *instr = program_[pc].get();
+
+        if (instr->opcode == OpJmp || instr->opcode == OpJz || instr->opcode == OpJnz)
+            leader_[instr->target] = 1;
+        else if (instr->opcode == OpRepeat)
+            leader_[pc + 1] = 1;
+        else if (instr->opcode == OpEnd)
+            leader_[pc + 1] = 1;
+    }
+}
+
+int8_t  TypeInference::peek(state_t const & state, size_t depth)
+{
+    return depth < state.types.size() ? state.types[state.types.size() - 1 - depth] : unknown;
+}
+
+// false when the pop would fail at run time, which stops the VM.
+bool    TypeInference::drop(state_t & state, size_t count)
+{
+    if (count > state.types.size() && !state.deep)
+        return false;
+    state.types.resize(count > state.types.size() ? 0 : state.types.size() - count);
+    return true;
+}
+
+void    TypeInference::flow(size_t pc, state_t const & state)
+{
+    state_t &joined = states_[pc];
+
+    if (!joined.reached)
+    {
+        joined = state;
+        worklist_.push_back(pc);
+        return ;
+    }
+
+    size_t  common = std::min(joined.types.size(), state.types.size());
+    bool    changed = joined.types.size() != common || (!joined.deep && (state.deep || state.types.size() != common));
+
+    joined.deep = joined.deep || state.deep || joined.types.size() != state.types.size();
+    joined.types.erase(joined.types.begin(), joined.types.end() - common);
+    for (size_t depth = 0; depth < common; depth++)
+    {
+        int8_t  &slot = joined.types[common - 1 - depth];
+
+        if (slot != unknown && slot != peek(state, depth))
+        {
+            slot = unknown;
+            changed = true;
+        }
+    }
+    if (changed)
+        worklist_.push_back(pc);
+}
+
+void    TypeInference::record(size_t pc, state_t const & state)
+{
+    int8_t  left = peek(state, 1), right = peek(state, 0);
+
+    if (left_[pc] == unset)
+    {
+        left_[pc] = left;
+        right_[pc] = right;
+    }
+    else if (left_[pc] != left || right_[pc] != right)
+        left_[pc] = right_[pc] = unknown;
+}
+
+void    TypeInference::walk(size_t pc)
+{
+    state_t state = states_[pc];
+
+    for (; pc < program_.size(); pc++)
+    {
+        instruction_t const *instr = program_[pc].get();
+
+        switch (instr->opcode)
+        {
+            case OpPush:
+                state.types.insert(state.types.end(), std::min<uint64_t>(instr->count, trackedSlots + 1),
+                                   static_cast<int8_t>(instr->arg->type));
+                break ;
+            case OpPop:
+                if (!drop(state, instr->count))
+                    return ;
+                break ;
+            case OpPrint:
+            case OpJz:
+            case OpJnz:
+            case OpDup:
+                if (state.types.empty() && !state.deep)
+                    return ;
+                if (instr->opcode == OpDup)
+                    state.types.push_back(peek(state, 0));
+                if (instr->opcode == OpJz || instr->opcode == OpJnz)
+                    flow(instr->target, state);
+                break ;
+            case OpOver:
+            case OpSwap:
+                if (state.types.size() < 2 && !state.deep)
+                    return ;
+                if (instr->opcode == OpOver)
+                    state.types.push_back(peek(state, 1));
+                else
+                {
+                    int8_t  top = peek(state, 0), second = peek(state, 1);
+
+                    drop(state, 2);
+                    state.types.push_back(top);
+                    state.types.push_back(second);
+                }
+                break ;
+            case OpRot:
+            {
+                if (state.types.size() < 3 && !state.deep)
+                    return ;
+
+                int8_t  top = peek(state, 0), second = peek(state, 1), third = peek(state, 2);
+
+                drop(state, 3);
+                state.types.push_back(second);
+                state.types.push_back(top);
+                state.types.push_back(third);
+                break ;
+            }
+            case OpClear:
+                state.types.clear();
+                state.deep = false;
+                break ;
+            case OpAssert:
+            case OpDump:
+                break ;
+            case OpExit:
+                return ;
+            case OpRepeat:
+                flow(instr->count ? pc + 1 : instr->target + 1, state);
+                return ;
+            case OpEnd:
+                flow(instr->target + 1, state);
+                flow(pc + 1, state);
+                return ;
+            case OpJmp:
+                flow(instr->target, state);
+                return ;
+            default:
+            {
+                if (state.types.size() < 2 && !state.deep)
+                    return ;
+                record(pc, state);
+
+                int8_t  left = peek(state, 1), right = peek(state, 0);
+
+                drop(state, 2);
+                state.types.push_back(left == unknown || right == unknown ? unknown : std::max(left, right));
+            }
+        }
+        if (state.types.size() > trackedSlots)
+        {
+            state.types.erase(state.types.begin(), state.types.end() - trackedSlots);
+            state.deep = true;
+        }
+        if (leader_[pc + 1])
+        {
+            flow(pc + 1, state);
+            return ;
+        }
+    }
+}
+
+void    TypeInference::annotate(size_t entry, bool knownStack, bool cacheTop)
+{
+    state_t start = { std::vector<int8_t>(), !knownStack, true };
+
+    flow(entry, start);
+    while (!worklist_.empty())
+    {
+        size_t  pc = worklist_.back();
+
+        worklist_.pop_back();
+        walk(pc);
+    }
+    for (size_t pc = 0; pc < program_.size(); pc++)
+    {
+        instruction_t   *instr = program_[pc].get();
+
+        instr->handler = 0;
+        if (instr->opcode >= OpAdd && instr->opcode <= OpMod && left_[pc] >= 0 && right_[pc] >= 0)
+            instr->handler = (cacheTop ? AVM::cachedHandlers : AVM::arithmeticHandlers)
+                             [instr->opcode - OpAdd][left_[pc]][right_[pc]];
+        else if (cacheTop && instr->opcode == OpPush && instr->count == 1)
+            instr->handler = &AVM::pushCached;
+    }
+}
+
+bool    TypeInference::operandTypes(size_t pc, eOperandType & left, eOperandType & right) const
+{
+    if (left_[pc] < 0 || right_[pc] < 0)
+        return false;
+    left = static_cast<eOperandType>(left_[pc]);
+    right = static_cast<eOperandType>(right_[pc]);
+    return true;
+}
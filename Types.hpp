@@ -0,0 +1,51 @@
+#ifndef TYPES_HPP
+# define TYPES_HPP
+
+#include "AVM.hpp"
+#include <vector>
+
+// Static types of the stack slots. The program is walked from its entry as
+// basic blocks; the abstract stack is only stored at block leaders (jump
+// targets, loop heads and the instruction after a loop), where incoming
+// stacks are joined: slots that disagree become unknown, and stacks of
+// different depths keep their common top over an unknown bottom. Every
+// arithmetic instruction whose two operand types are known on all paths
+// gets the handler specialised for them; with cacheTop, the handler that
+// keeps the top of the stack unboxed, and so do literal pushes.
+
+class TypeInference
+{
+
+    struct  state_t
+    {
+        std::vector<int8_t> types;
+        bool                deep;
+        bool                reached;
+    };
+
+    program_t                   &program_;
+    std::vector<char>           leader_;
+    std::vector<state_t>        states_;
+    std::vector<size_t>         worklist_;
+    std::vector<int8_t>         left_;
+    std::vector<int8_t>         right_;
+
+    void            flow    (size_t pc, state_t const & state);
+    void            walk    (size_t pc);
+    void            record  (size_t pc, state_t const & state);
+
+    static int8_t   peek    (state_t const & state, size_t depth);
+    static bool     drop    (state_t & state, size_t count);
+
+public:
+
+    explicit TypeInference(program_t & program);
+    TypeInference(TypeInference const &) = delete;
+    TypeInference & operator = (TypeInference const &) = delete;
+
+    void    annotate(size_t entry = 0, bool knownStack = true, bool cacheTop = false);
+    bool    operandTypes(size_t pc, eOperandType & left, eOperandType & right) const;
+
+};
+
+#endif
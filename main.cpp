@@ -1,15 +1,380 @@
 #include "Lexer.hpp"
 #include "AVM.hpp"
+#include "Snapshot.hpp"
+#include "Trace.hpp"
+#include "Batch.hpp"
+#include "IR.hpp"
+#include "Parallel.hpp"
+#include "Scheduler.hpp"
+#include "Types.hpp"
+#include "Incremental.hpp"
+#include "Profile.hpp"
+#include "Aot.hpp"
+#include "ResultCache.hpp"
+#include "Probes.hpp"
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <cstdlib>
+
+// Largest program the repeat blocks are unrolled into for the static engines
+static const size_t unrollLimit = 1 << 22;
+
+struct  options_t
+{
+    char const  *sourcePath = 0;
+    std::vector<char const *>   sources;
+    char const  *checkpointPath = 0;
+    char const  *resumePath = 0;
+    char const  *tracePath = 0;
+    char const  *traceDecodePath = 0;
+    char const  *batchPath = 0;
+    char const  *cacheDir = 0;
+    char const  *profilePath = 0;
+    char const  *aotPath = 0;
+    char const  *resultCache = 0;
+    bool        irDump = false;
+    bool        optimize = false;
+    bool        parallel = false;
+    bool        incremental = false;
+    bool        watch = false;
+    bool        cacheTop = false;
+    bool        stats = false;
+    size_t      threads = 0;
+    size_t      checkpointEvery = 0;
+    size_t      traceSize = 4096;
+    size_t      stackWindow = 0;
+    size_t      checkpointLines = 64;
+    unsigned    sampleRate = 1000;
+    uint64_t    resultCacheSize = 64;
+    uint64_t    cacheSize = 64;
+    limits_t    limits;
+    uint64_t    quantum = 0;
+};
+
+static int  usage(char const *name)
+{
+    std::cerr << "usage: " << name << " [--checkpoint file] [--checkpoint-every N]"
+              << " [--resume file] [--trace file] [--trace-size N]" << std::endl
+              << "       " << std::string(std::strlen(name), ' ') << " [--parallel N] [--stack-window N] [--tos]"
+              << " [--optimize] [--sample-profile file] [--sample-rate Hz]" << std::endl
+              << "       " << std::string(std::strlen(name), ' ') << " [--max-instructions N] [--max-time ms]"
+              << " [--max-stack N] [source_file]" << std::endl
+              << "       " << name << " --result-cache dir [--result-cache-size MB] [--stats]" << std::endl
+              << "       " << std::string(std::strlen(name), ' ') << " [--optimize] [--tos] [--parallel N]"
+              << " [--max-instructions N] [--max-stack N] [source_file]" << std::endl
+              << "       " << name << " [--quantum N] [--max-...] source_file..." << std::endl
+              << "       " << name << " --incremental|--watch [--cache-dir dir] [--cache-size MB]"
+              << " [--checkpoint-lines N]" << std::endl
+              << "       " << std::string(std::strlen(name), ' ') << " [--max-time ms] [--max-stack N] source_file"
+              << std::endl
+              << "       " << name << " --ir-dump [source_file]" << std::endl
+              << "       " << name << " --aot output.cpp [source_file]"
+              << "    then: c++ -std=c++11 -O2 output.cpp -o program" << std::endl
+              << "       " << name << " --trace-decode trace_file [source_file]" << std::endl
+              << "       " << name << " --batch input_file [--optimize] [source_file]" << std::endl;
+    return 1;
+}
+
+static bool parseOptions(int ac, char **av, options_t & options)
+{
+    for (int i = 1; i < ac; i++)
+    {
+        std::string option(av[i]);
+
+        if (option.compare(0, 2, "--") || option == "--")
+        {
+            options.sources.push_back(av[i]);
+            options.sourcePath = options.sources.front();
+        }
+        else if (option == "--ir-dump")
+            options.irDump = true;
+        else if (option == "--optimize")
+            options.optimize = true;
+        else if (option == "--tos")
+            options.cacheTop = true;
+        else if (option == "--incremental")
+            options.incremental = true;
+        else if (option == "--watch")
+            options.incremental = options.watch = true;
+        else if (i + 1 == ac)
+            return false;
+        else if (option == "--checkpoint")
+            options.checkpointPath = av[++i];
+        else if (option == "--resume")
+            options.resumePath = av[++i];
+        else if (option == "--checkpoint-every")
+            options.checkpointEvery = std::strtoull(av[++i], 0, 10);
+        else if (option == "--trace")
+            options.tracePath = av[++i];
+        else if (option == "--trace-size")
+            options.traceSize = std::strtoull(av[++i], 0, 10);
+        else if (option == "--trace-decode")
+            options.traceDecodePath = av[++i];
+        else if (option == "--max-instructions")
+            options.limits.maxInstructions = std::strtoull(av[++i], 0, 10);
+        else if (option == "--max-time")
+            options.limits.maxTime = std::strtoull(av[++i], 0, 10);
+        else if (option == "--max-stack")
+            options.limits.maxStack = std::strtoull(av[++i], 0, 10);
+        else if (option == "--quantum")
+            options.quantum = std::strtoull(av[++i], 0, 10);
+        else if (option == "--stack-window")
+            options.stackWindow = std::strtoull(av[++i], 0, 10);
+        else if (option == "--batch")
+            options.batchPath = av[++i];
+        else if (option == "--cache-dir")
+        {
+            options.incremental = true;
+            options.cacheDir = av[++i];
+        }
+        else if (option == "--cache-size")
+        {
+            options.incremental = true;
+            options.cacheSize = std::strtoull(av[++i], 0, 10);
+        }
+        else if (option == "--result-cache")
+            options.resultCache = av[++i];
+        else if (option == "--result-cache-size")
+            options.resultCacheSize = std::strtoull(av[++i], 0, 10);
+        else if (option == "--stats")
+            options.stats = true;
+        else if (option == "--aot")
+            options.aotPath = av[++i];
+        else if (option == "--sample-profile")
+            options.profilePath = av[++i];
+        else if (option == "--sample-rate")
+            options.sampleRate = std::strtoul(av[++i], 0, 10);
+        else if (option == "--checkpoint-lines")
+            options.checkpointLines = std::strtoull(av[++i], 0, 10);
+        else if (option == "--parallel")
+        {
+            options.parallel = true;
+            options.threads = std::strtoull(av[++i], 0, 10);
+        }
+        else
+            return false;
+    }
+    if (options.stats && !options.resultCache)
+        return false;
+    // Snapshots and traces name instructions of the program as written
+    if (options.optimize && (options.checkpointPath || options.resumePath || options.tracePath
+                             || options.traceDecodePath))
+        return false;
+    // Only runs whose output the program alone decides are kept
+    if (options.resultCache && (options.incremental || options.sources.size() > 1 || options.quantum
+                                || options.checkpointPath || options.resumePath || options.tracePath
+                                || options.traceDecodePath || options.batchPath || options.irDump || options.aotPath
+                                || options.profilePath || options.limits.maxTime))
+        return false;
+    if (options.incremental)
+        return options.sources.size() == 1 && !options.quantum && !options.limits.maxInstructions
+               && !options.checkpointPath && !options.resumePath && !options.tracePath && !options.traceDecodePath
+               && !options.batchPath && !options.irDump && !options.optimize && !options.parallel
+               && !options.profilePath;
+    if (options.sources.size() > 1 || options.quantum)
+        return !options.checkpointPath && !options.resumePath && !options.tracePath && !options.traceDecodePath
+               && !options.batchPath && !options.irDump && !options.optimize && !options.parallel
+               && !options.profilePath;
+    return true;
+}
+
+struct  job_t
+{
+    char const          *path;
+    program_t           program;
+    Transcript          output;
+    AVM                 vm;
+    bool                named = false;
+};
+
+// Runs every source in its own VM, interleaved by a single-thread scheduler.
+// Each VM writes into its own transcript, replayed at the end of each of its
+// turns under a header naming the source whenever another one spoke last.
+static int  runScheduled(options_t const & options)
+{
+    std::vector<std::unique_ptr<job_t> >    jobs;
+    Scheduler                               scheduler(options.quantum ? options.quantum : 1000);
+    int                                     status = 0;
+    size_t                                  shown = SIZE_MAX;
+
+    for (char const * path : options.sources)
+    {
+        std::unique_ptr<job_t>  job(new job_t);
+        std::ifstream           file(path);
+        Lexer                   lexer(job->program, &file);
+
+        job->path = path;
+        if (!file.is_open())
+        {
+            std::cerr << path << ": Error opening file!" << std::endl;
+            continue ;
+        }
+        AVM::lexerError = false;
+        lexer.readBuf();
+        if (!AVM::lexerError && (job->program.empty() || job->program.back()->opcode != OpExit))
+        {
+            std::cerr << path << ": Missing exit instruction !" << std::endl;
+            continue ;
+        }
+        if (AVM::lexerError)
+        {
+            std::cerr << path << ": not run" << std::endl;
+            continue ;
+        }
+        TypeInference(job->program).annotate(0, true, options.cacheTop);
+        job->output.capture(job->vm);
+        job->vm.limits = options.limits;
+        job->vm.setStackWindow(options.stackWindow);
+        scheduler.add(job->vm, job->program);
+        jobs.push_back(std::move(job));
+    }
+
+    AVM_PROBE1(phase, "run");
+    try
+    {
+        scheduler.run([&jobs, &status, &shown](size_t id, eRunStatus result)
+        {
+            job_t   &job = *jobs[id];
+
+            if ((shown != id && !job.output.data().empty()) || (result != Yielded && !job.named))
+            {
+                std::cout << "==> " << job.path << " <==" << std::endl;
+                shown = id;
+                job.named = true;
+            }
+            Transcript::replay(job.output.data(), std::cout, std::cerr);
+            job.output.clear();
+            if (result == Yielded)
+                return ;
+            if (result == BudgetExceeded)
+                status = 2;
+            jobs[id].reset();
+        });
+    }
+    catch (std::exception const & error)
+    {
+        std::cerr << "Error spilling stack: " << error.what() << std::endl;
+        return 1;
+    }
+    AVM_PROBE1(phase, "done");
+    return status;
+}
+
+static bool readSource(char const * path, std::string & source)
+{
+    std::ifstream   file(path, std::ios::binary);
+
+    source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return file.is_open();
+}
+
+// Reruns of one source from its prefix checkpoints. With --watch the file is
+// polled and every saved edit is run again from the last unchanged prefix.
+static int  runIncremental(options_t const & options)
+{
+    Incremental     incremental(options.checkpointLines, options.cacheDir ? options.cacheDir : "",
+                                    options.cacheSize << 20);
+    std::string     source;
+    int             status = 0;
+
+    for (bool first = true; ; first = false)
+    {
+        if (!readSource(options.sourcePath, source))
+        {
+            std::cerr << "Error opening file!" << std::endl;
+            return 1;
+        }
+        if (options.watch)
+            std::cout << "==> " << options.sourcePath << " <==" << std::endl;
+
+        std::istringstream  stream(source);
+        program_t           program;
+        Lexer               lexer(program, &stream);
+
+        AVM::lexerError = false;
+        lexer.readBuf();
+        if (program.empty())
+            std::cerr << "missing exit" << std::endl;
+        else if (program.back()->opcode != OpExit)
+            std::cerr << "Missing exit instruction !" << std::endl;
+        else if (!AVM::lexerError)
+        {
+            AVM     vm;
+
+            vm.limits = options.limits;
+            vm.setStackWindow(options.stackWindow);
+            try
+            {
+                status = incremental.run(source, program, vm) == BudgetExceeded ? 2 : 0;
+            }
+            catch (OperandStack::SpillErrorException const & error)
+            {
+                std::cerr << "Error spilling stack: " << error.what() << std::endl;
+                status = 1;
+            }
+            catch (std::exception const & error)
+            {
+                std::cerr << "Error writing checkpoint: " << error.what() << std::endl;
+                status = 1;
+            }
+            if (options.watch && !first)
+                std::cerr << options.sourcePath << ": resumed after line " << incremental.resumedAt() << std::endl;
+        }
+        if (!options.watch)
+            return status;
+
+        std::string     current;
+
+        while (readSource(options.sourcePath, current) && current == source)
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+}
+
+static void requestCheckpoint(int)
+{
+    AVM::checkpointRequested = 1;
+}
+
+static void requestTraceDump(int)
+{
+    Tracer::dumpRequested = 1;
+}
 
 int     main(int ac, char **av)
 {
-    std::ifstream                               file;
-    std::list<std::unique_ptr<instruction_t> >  instructions;
-    Lexer                                       lexer(instructions);
+    std::ifstream   file;
+    program_t       instructions;
+    Lexer           lexer(instructions);
+    options_t       options;
+
+    if (!parseOptions(ac, av, options))
+        return usage(av[0]);
+
+    if (options.incremental)
+        return runIncremental(options);
+    if (options.sources.size() > 1 || options.quantum)
+        return runScheduled(options);
+
+    if (options.traceDecodePath)
+    {
+        try
+        {
+            Tracer::decode(options.traceDecodePath, options.sourcePath, std::cout);
+        }
+        catch (std::exception const & error)
+        {
+            std::cerr << "Error decoding " << options.traceDecodePath << ": " << error.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-    if (ac == 2)
+    if (options.sourcePath)
     {
-        file.open(av[1]);
+        file.open(options.sourcePath);
         lexer.setVmStream(&file);
         if (!file.is_open()) {
             std::cerr << "Error opening file!" << std::endl;
@@ -19,6 +384,8 @@ int     main(int ac, char **av)
     else
         lexer.setVmStream(&std::cin);
 
+    lexer.setParamsAllowed(options.batchPath || options.irDump);
+    AVM_PROBE1(phase, "lex");
     lexer.readBuf();
 
     auto revIt = instructions.rbegin();
@@ -27,19 +394,196 @@ int     main(int ac, char **av)
         std::cerr << "missing exit" << std::endl;
         return 1;
     }
-    if (*(revIt->get()->name) != "exit")
+    if (revIt->get()->opcode != OpExit)
     {
         std::cerr << "Missing exit instruction !" << std::endl;
-        AVM::exitFlag = true;
+        AVM::vm.exitFlag = true;
+    }
+
+    if (options.aotPath)
+    {
+        if (AVM::lexerError || AVM::vm.exitFlag)
+            return 1;
+
+        std::ofstream   generated(options.aotPath);
+
+        Aot(instructions).write(generated, options.sourcePath ? options.sourcePath : "stdin");
+        if (!generated.flush())
+        {
+            std::cerr << "Error writing " << options.aotPath << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<ResultCache>    cache;
+    std::string                     cacheKey;
+
+    if (options.resultCache && !AVM::lexerError && !AVM::vm.exitFlag)
+    {
+        int     status;
+
+        cache.reset(new ResultCache(options.resultCache, options.resultCacheSize << 20));
+        cacheKey = ResultCache::key(instructions, options.limits);
+        if (cache->replay(cacheKey, std::cout, std::cerr, status))
+        {
+            if (options.stats)
+                cache->writeStats(std::cerr);
+            return status;
+        }
+        cache->record(AVM::vm);
+    }
+
+    bool    straight = Lexer::isStraight(instructions);
+
+    if (!straight && !AVM::lexerError && (options.irDump || options.optimize || options.parallel))
+    {
+        program_t   unrolled;
+
+        AVM_PROBE1(phase, "unroll");
+        if ((straight = Lexer::unroll(instructions, unrolled, unrollLimit)))
+            instructions.swap(unrolled);
+    }
+    if (!straight && !AVM::lexerError && options.irDump)
+    {
+        std::cerr << "--ir-dump needs a program without conditional jumps or huge repeats" << std::endl;
+        return 1;
+    }
+
+    if (!AVM::lexerError && !AVM::vm.exitFlag && straight && (options.irDump || options.optimize))
+    {
+        IR          ir(instructions);
+        program_t   lowered;
+
+        AVM_PROBE1(phase, "ir");
+        ir.optimize();
+        if (options.irDump)
+        {
+            ir.dump(std::cout);
+            return 0;
+        }
+        ir.lower(lowered);
+        instructions.swap(lowered);
     }
 
-    if (!AVM::lexerError)
+    if (!AVM::lexerError && options.batchPath && !AVM::vm.exitFlag)
     {
-        for (std::unique_ptr<instruction_t> &value : instructions)
-            if (!AVM::exitFlag)
-                AVM::vm.runInstruction(value.get());
-            else
-                break;
+        Batch   batch(instructions);
+
+        AVM_PROBE1(phase, "batch");
+        try
+        {
+            batch.load(options.batchPath);
+            batch.run();
+        }
+        catch (Batch::StackErrorException const & error)
+        {
+            std::cerr << "Error on line " << error.line << " " << error.what() << std::endl;
+            return 1;
+        }
+        catch (std::exception const & error)
+        {
+            std::cerr << "Error in batch " << options.batchPath << ": " << error.what() << std::endl;
+            return 1;
+        }
+        batch.write(std::cout);
+    }
+    else if (!AVM::lexerError && !options.batchPath)
+    {
+        AVM::vm.programHash = Snapshot::hashProgram(instructions);
+        AVM::vm.setStackWindow(options.stackWindow);
+        AVM::vm.limits = options.limits;
+        if (options.resumePath)
+        {
+            try
+            {
+                Snapshot::load(options.resumePath, AVM::vm);
+            }
+            catch (std::exception const & error)
+            {
+                std::cerr << "Error resuming from " << options.resumePath << ": " << error.what() << std::endl;
+                return 1;
+            }
+        }
+        AVM_PROBE1(phase, "infer");
+        TypeInference(instructions).annotate(AVM::vm.getPc(), !options.resumePath,
+                                             options.cacheTop && !options.tracePath && !options.parallel);
+        if (options.checkpointPath)
+        {
+            AVM::vm.checkpointPath = options.checkpointPath;
+            AVM::vm.checkpointEvery = options.checkpointEvery;
+            std::signal(SIGUSR1, requestCheckpoint);
+        }
+        std::unique_ptr<Tracer>     tracer;
+
+        if (options.tracePath)
+        {
+            tracer.reset(new Tracer(options.tracePath, options.traceSize));
+            AVM::vm.tracer = tracer.get();
+            std::signal(SIGUSR2, requestTraceDump);
+        }
+        std::unique_ptr<Profiler>   profiler;
+
+        if (options.profilePath)
+        {
+            profiler.reset(new Profiler(instructions, options.sourcePath ? options.sourcePath : "stdin", options.sampleRate));
+            AVM::vm.profiler = profiler.get();
+        }
+        std::vector<IOperand const *>   precomputed;
+        size_t                          threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+
+        if (options.parallel && straight)
+        {
+            Dataflow    dataflow(instructions);
+
+            if (dataflow.worthRunning(threads))
+            {
+                AVM_PROBE1(phase, "parallel");
+                dataflow.run(threads);
+                dataflow.results(precomputed);
+                AVM::vm.precomputed = &precomputed;
+            }
+        }
+        try
+        {
+            AVM_PROBE1(phase, "run");
+            if (profiler)
+                profiler->start();
+
+            eRunStatus  status = AVM::vm.run(instructions);
+
+            AVM_PROBE1(phase, "done");
+            if (profiler)
+            {
+                profiler->stop();
+                profiler->write(options.profilePath);
+            }
+            for (IOperand const * operand : precomputed)
+                delete operand;
+            if (cache)
+            {
+                cache->store(cacheKey, status == BudgetExceeded ? 2 : 0);
+                if (options.stats)
+                    cache->writeStats(std::cerr);
+            }
+            if (status == BudgetExceeded)
+                return 2;
+        }
+        catch (OperandStack::SpillErrorException const & error)
+        {
+            std::cerr << "Error spilling stack: " << error.what() << std::endl;
+            return 1;
+        }
+        catch (Profiler::WriteErrorException const & error)
+        {
+            std::cerr << "Error writing " << options.profilePath << ": " << error.what() << std::endl;
+            return 1;
+        }
+        catch (std::exception const & error)
+        {
+            std::cerr << "Error writing checkpoint: " << error.what() << std::endl;
+            return 1;
+        }
     }
     // system("leaks avm");
     return 0;
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Records the avm:dispatch tracepoint with perf and prints the time spent per
+# opcode and per source line, like the bpftrace scripts do.
+#
+#   scripts/perf_opcodes.sh program.avm [avm options...]
+
+AVM=${AVM:-./avm}
+DATA=${DATA:-avm.perf.data}
+
+perf buildid-cache --add "$AVM" || exit 1
+perf probe -x "$AVM" -d 'sdt_avm:*' >/dev/null 2>&1
+perf probe -x "$AVM" -a sdt_avm:dispatch -a sdt_avm:phase >/dev/null || exit 1
+perf record -q -o "$DATA" -e sdt_avm:dispatch -e sdt_avm:phase -- "$AVM" "$@" >/dev/null || exit 1
+
+# perf numbers tracepoint arguments from 1: arg2 is the opcode and arg3 the
+# source line of the dispatched instruction.
+perf script -i "$DATA" -F tid,time,event,trace | awk '
+{
+    gsub(":", "", $2)
+    now = $2 * 1000000000
+    if ($1 in since)
+    {
+        opNs[op[$1]] += now - since[$1]
+        lineNs[line[$1]] += now - since[$1]
+        delete since[$1]
+    }
+    if ($3 ~ /dispatch/)
+    {
+        since[$1] = now
+        for (i = 4; i <= NF; i++)
+        {
+            if ($i ~ /^arg2=/)
+                op[$1] = substr($i, 6)
+            if ($i ~ /^arg3=/)
+                line[$1] = substr($i, 6)
+        }
+    }
+}
+END {
+    for (o in opNs)
+        printf "opcode %-4s %12.0f ns\n", o, opNs[o] | "sort -k3 -rn"
+    close("sort -k3 -rn")
+    for (l in lineNs)
+        printf "line   %-6s %12.0f ns\n", l, lineNs[l] | "sort -k3 -rn"
+}'
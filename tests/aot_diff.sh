@@ -0,0 +1,50 @@
+#!/bin/sh
+# Compiles every test program with avm --aot and checks that the binary
+# prints the same stdout and stderr, and exits with the same status, as the
+# interpreter. Programs avm refuses to compile (lexer errors) only have to
+# report the same diagnostics.
+#
+#   tests/aot_diff.sh [program.avm...]
+
+AVM=${AVM:-./avm}
+CXX=${CXX:-c++}
+TMP=${TMPDIR:-/tmp}/aot_diff.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+[ $# -gt 0 ] || set -- tests/*.avm
+failed=0
+
+for program in "$@"
+do
+    "$AVM" "$program" >"$TMP/want.out" 2>"$TMP/want.err" </dev/null
+    wantStatus=$?
+    if ! "$AVM" --aot "$TMP/program.cpp" "$program" 2>"$TMP/aot.err" </dev/null
+    then
+        if ! cmp -s "$TMP/want.err" "$TMP/aot.err"
+        then
+            echo "FAIL $program: --aot diagnostics differ"
+            failed=1
+        else
+            echo "ok   $program (not compiled)"
+        fi
+        continue
+    fi
+    if ! "$CXX" -std=c++11 -O2 "$TMP/program.cpp" -o "$TMP/program"
+    then
+        echo "FAIL $program: generated code does not compile"
+        failed=1
+        continue
+    fi
+    "$TMP/program" >"$TMP/got.out" 2>"$TMP/got.err" </dev/null
+    gotStatus=$?
+    if ! cmp -s "$TMP/want.out" "$TMP/got.out" || ! cmp -s "$TMP/want.err" "$TMP/got.err" \
+        || [ $wantStatus -ne $gotStatus ]
+    then
+        echo "FAIL $program"
+        failed=1
+        continue
+    fi
+    echo "ok   $program"
+done
+exit $failed
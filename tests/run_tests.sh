@@ -0,0 +1,53 @@
+#!/bin/sh
+# Runs every test program and compares what avm prints with the expected
+# output next to it (tests/NN_name.out): for each run, the options, stdout
+# and stderr together, then the exit status. A program runs once without
+# options unless it has "; run: options..." lines, which run in order; in
+# them $SRC is the program and $TMP a scratch directory shared by its runs.
+#
+#   tests/run_tests.sh [--update] [program.avm...]
+
+AVM=${AVM:-./avm}
+TMP=${TMPDIR:-/tmp}/run_tests.$$
+update=0
+failed=0
+
+if [ "$1" = "--update" ]
+then
+    update=1
+    shift
+fi
+[ $# -gt 0 ] || set -- tests/*.avm
+trap 'rm -rf "$TMP"' EXIT
+
+for SRC in "$@"
+do
+    expected=${SRC%.avm}.out
+    rm -rf "$TMP" && mkdir -p "$TMP" || exit 1
+    runs=$(sed -n 's/^; run: //p' "$SRC")
+    [ -n "$runs" ] || runs='$SRC'
+
+    echo "$runs" | while IFS= read -r options
+    do
+        echo "\$ avm $options"
+        eval "\"\$AVM\" $options" </dev/null 2>&1
+        echo "status $?"
+    done >"$TMP/got" 2>&1
+
+    if [ $update = 1 ]
+    then
+        cp "$TMP/got" "$expected" && echo "wrote $expected"
+    elif [ ! -f "$expected" ]
+    then
+        echo "FAIL $SRC: no $expected"
+        failed=1
+    elif ! cmp -s "$TMP/got" "$expected"
+    then
+        echo "FAIL $SRC"
+        diff "$expected" "$TMP/got" | head -20
+        failed=1
+    else
+        echo "ok   $SRC"
+    fi
+done
+exit $failed